@@ -0,0 +1,955 @@
+// Бенчмарки bimap. Запуск с JSON-выводом для отслеживания регрессий:
+//   cmake --build <build> --target bench
+// или вручную:
+//   benchmarks --benchmark_out=bench.json --benchmark_out_format=json
+// Отдельные группы выбираются через --benchmark_filter, например
+// --benchmark_filter='BM_find_left_hit<bimap_impl, int>'.
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "bimap.h"
+#include "compact_allocator.h"
+#include "concurrent_bimap.h"
+#include "frozen_bimap.h"
+#include "pool_allocator.h"
+#include "sharded_bimap.h"
+#include <benchmark/benchmark.h>
+
+#ifdef HAVE_BOOST_BIMAP
+#include <boost/bimap.hpp>
+#include <boost/bimap/set_of.hpp>
+#endif
+
+namespace {
+
+// Ключ размером 64 байта со сравнением по всем полям.
+struct struct64 {
+  std::array<uint64_t, 8> data{};
+
+  friend bool operator<(struct64 const& a, struct64 const& b) {
+    return a.data < b.data;
+  }
+};
+
+template <typename K>
+K make_key(uint64_t x);
+
+template <>
+int make_key<int>(uint64_t x) {
+  return static_cast<int>(x);
+}
+
+template <>
+std::string make_key<std::string>(uint64_t x) {
+  std::string res = "key-" + std::to_string(x);
+  res.insert(0, 24 - std::min<size_t>(res.size(), 24), '0');
+  return res;
+}
+
+template <>
+struct64 make_key<struct64>(uint64_t x) {
+  struct64 res;
+  res.data.fill(x / 7);
+  res.data.back() = x;
+  return res;
+}
+
+// Попарно различные значения, перемешанные: [0, n) -- ключи в контейнере,
+// [n, 2n) -- промахи.
+template <typename K>
+struct dataset {
+  std::vector<K> lefts, rights, left_misses, right_misses;
+
+  explicit dataset(size_t n) {
+    std::mt19937_64 e(n);
+    std::vector<uint64_t> ids(2 * n);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::shuffle(ids.begin(), ids.end(), e);
+    for (size_t i = 0; i < n; i++) {
+      lefts.push_back(make_key<K>(2 * ids[i]));
+      left_misses.push_back(make_key<K>(2 * ids[n + i]));
+    }
+    std::shuffle(ids.begin(), ids.end(), e);
+    for (size_t i = 0; i < n; i++) {
+      rights.push_back(make_key<K>(2 * ids[i] + 1));
+      right_misses.push_back(make_key<K>(2 * ids[n + i] + 1));
+    }
+  }
+
+  static dataset const& get(size_t n) {
+    static std::map<size_t, dataset> cache;
+    auto it = cache.find(n);
+    if (it == cache.end())
+      it = cache.emplace(n, dataset(n)).first;
+    return it->second;
+  }
+};
+
+// Единый интерфейс над сравниваемыми реализациями.
+template <typename K, typename Allocator = std::allocator<std::pair<K, K>>>
+struct basic_bimap_impl {
+  using map_t = bimap<K, K, std::less<K>, std::less<K>,
+                      intrusive::avl_balance, Allocator>;
+
+  static bool insert(map_t& m, K const& l, K const& r) {
+    return m.insert(l, r) != m.end_left();
+  }
+  static bool has_left(map_t const& m, K const& l) {
+    return m.find_left(l) != m.end_left();
+  }
+  static bool has_right(map_t const& m, K const& r) {
+    return m.find_right(r) != m.end_right();
+  }
+  static auto lower_bound_left(map_t const& m, K const& l) {
+    return m.lower_bound_left(l) != m.end_left();
+  }
+  static auto upper_bound_left(map_t const& m, K const& l) {
+    return m.upper_bound_left(l) != m.end_left();
+  }
+  static bool erase_left(map_t& m, K const& l) {
+    return m.erase_left(l);
+  }
+  static void erase_first(map_t& m) {
+    m.erase_left(m.begin_left());
+  }
+  template <typename F>
+  static void for_each_left(map_t const& m, F f) {
+    for (auto it = m.begin_left(); it != m.end_left(); ++it)
+      f(*it);
+  }
+  template <typename F>
+  static void for_each_right(map_t const& m, F f) {
+    for (auto it = m.begin_right(); it != m.end_right(); ++it)
+      f(*it);
+  }
+};
+
+template <typename K>
+using bimap_impl = basic_bimap_impl<K>;
+
+// Узлы с 32-битными связями в compact_arena.
+template <typename K>
+using compact_impl = basic_bimap_impl<K, compact_allocator<K>>;
+
+// Пара std::map, поддерживаемых согласованными вручную.
+template <typename K>
+struct two_maps_impl {
+  struct map_t {
+    std::map<K, K> left, right;
+
+    void swap(map_t& other) {
+      left.swap(other.left);
+      right.swap(other.right);
+    }
+    size_t size() const {
+      return left.size();
+    }
+  };
+
+  static bool insert(map_t& m, K const& l, K const& r) {
+    if (m.left.count(l) || m.right.count(r))
+      return false;
+    m.left.emplace(l, r);
+    m.right.emplace(r, l);
+    return true;
+  }
+  static bool has_left(map_t const& m, K const& l) {
+    return m.left.find(l) != m.left.end();
+  }
+  static bool has_right(map_t const& m, K const& r) {
+    return m.right.find(r) != m.right.end();
+  }
+  static auto lower_bound_left(map_t const& m, K const& l) {
+    return m.left.lower_bound(l) != m.left.end();
+  }
+  static auto upper_bound_left(map_t const& m, K const& l) {
+    return m.left.upper_bound(l) != m.left.end();
+  }
+  static bool erase_left(map_t& m, K const& l) {
+    auto it = m.left.find(l);
+    if (it == m.left.end())
+      return false;
+    m.right.erase(it->second);
+    m.left.erase(it);
+    return true;
+  }
+  static void erase_first(map_t& m) {
+    auto it = m.left.begin();
+    m.right.erase(it->second);
+    m.left.erase(it);
+  }
+  template <typename F>
+  static void for_each_left(map_t const& m, F f) {
+    for (auto const& p : m.left)
+      f(p.first);
+  }
+  template <typename F>
+  static void for_each_right(map_t const& m, F f) {
+    for (auto const& p : m.right)
+      f(p.first);
+  }
+};
+
+#ifdef HAVE_BOOST_BIMAP
+template <typename K>
+struct boost_impl {
+  using map_t =
+      boost::bimap<boost::bimaps::set_of<K>, boost::bimaps::set_of<K>>;
+
+  static bool insert(map_t& m, K const& l, K const& r) {
+    return m.insert(typename map_t::value_type(l, r)).second;
+  }
+  static bool has_left(map_t const& m, K const& l) {
+    return m.left.find(l) != m.left.end();
+  }
+  static bool has_right(map_t const& m, K const& r) {
+    return m.right.find(r) != m.right.end();
+  }
+  static auto lower_bound_left(map_t const& m, K const& l) {
+    return m.left.lower_bound(l) != m.left.end();
+  }
+  static auto upper_bound_left(map_t const& m, K const& l) {
+    return m.left.upper_bound(l) != m.left.end();
+  }
+  static bool erase_left(map_t& m, K const& l) {
+    return m.left.erase(l) != 0;
+  }
+  static void erase_first(map_t& m) {
+    m.left.erase(m.left.begin());
+  }
+  template <typename F>
+  static void for_each_left(map_t const& m, F f) {
+    for (auto const& p : m.left)
+      f(p.first);
+  }
+  template <typename F>
+  static void for_each_right(map_t const& m, F f) {
+    for (auto const& p : m.right)
+      f(p.first);
+  }
+};
+#endif
+
+template <template <typename> class Impl, typename K>
+typename Impl<K>::map_t build(dataset<K> const& data) {
+  typename Impl<K>::map_t m;
+  for (size_t i = 0; i < data.lefts.size(); i++)
+    Impl<K>::insert(m, data.lefts[i], data.rights[i]);
+  return m;
+}
+
+enum class insert_order { random, sorted, reverse };
+
+template <template <typename> class Impl, typename K, insert_order Order>
+void BM_insert(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<K>::get(n);
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  if (Order != insert_order::random) {
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return data.lefts[a] < data.lefts[b];
+    });
+    if (Order == insert_order::reverse)
+      std::reverse(order.begin(), order.end());
+  }
+  for (auto _ : state) {
+    auto* m = new typename Impl<K>::map_t();
+    for (size_t i : order)
+      Impl<K>::insert(*m, data.lefts[i], data.rights[i]);
+    benchmark::DoNotOptimize(m);
+    state.PauseTiming();
+    delete m;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <template <typename> class Impl, typename K>
+void BM_insert_random(benchmark::State& state) {
+  BM_insert<Impl, K, insert_order::random>(state);
+}
+template <template <typename> class Impl, typename K>
+void BM_insert_sorted(benchmark::State& state) {
+  BM_insert<Impl, K, insert_order::sorted>(state);
+}
+template <template <typename> class Impl, typename K>
+void BM_insert_reverse(benchmark::State& state) {
+  BM_insert<Impl, K, insert_order::reverse>(state);
+}
+
+// Дописывание возрастающих ключей в обе стороны: обычная вставка против
+// вставки с подсказкой end.
+template <bool Hinted>
+void BM_append_sorted(benchmark::State& state) {
+  int n = state.range(0);
+  for (auto _ : state) {
+    auto* m = new bimap<int, int>();
+    for (int i = 0; i < n; i++) {
+      if constexpr (Hinted)
+        m->insert(m->end_left(), m->end_right(), i, i);
+      else
+        m->insert(i, i);
+    }
+    benchmark::DoNotOptimize(m);
+    state.PauseTiming();
+    delete m;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Поиск n случайных ключей в дереве из n узлов: цикл find_left против
+// find_left_batch. На больших размерах дерево не помещается в LLC.
+template <bool Batched>
+void BM_find_left_batch(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<int>::get(n);
+  auto m = build<bimap_impl>(data);
+  std::vector<int> queries(data.lefts);
+  std::shuffle(queries.begin(), queries.end(), std::mt19937(n));
+  std::vector<bimap<int, int>::left_iterator> res(queries.size());
+  for (auto _ : state) {
+    if constexpr (Batched) {
+      m.find_left_batch(queries, res);
+    } else {
+      for (size_t i = 0; i < queries.size(); i++)
+        res[i] = m.find_left(queries[i]);
+    }
+    benchmark::DoNotOptimize(res.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Поиск в frozen_bimap против поиска в исходном bimap. Запросы -- ключи
+// контейнера вперемешку с промахами.
+template <typename K, bool Frozen, bool LowerBound>
+void BM_frozen(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<K>::get(n);
+  auto m = build<bimap_impl>(data);
+  frozen_bimap<K, K> f(m);
+  std::vector<K> queries;
+  for (size_t i = 0; i < n; i++)
+    queries.push_back(i % 2 ? data.lefts[i] : data.left_misses[i]);
+  for (auto _ : state) {
+    size_t found = 0;
+    for (auto const& key : queries) {
+      if constexpr (Frozen && LowerBound)
+        found += f.lower_bound_left(key) != f.end_left();
+      else if constexpr (Frozen)
+        found += f.find_left(key) != f.end_left();
+      else if constexpr (LowerBound)
+        found += m.lower_bound_left(key) != m.end_left();
+      else
+        found += m.find_left(key) != m.end_left();
+    }
+    benchmark::DoNotOptimize(found);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Поиск по right в хешируемой стороне против дерева. Запросы -- ключи
+// контейнера вперемешку с промахами.
+template <typename K, bool Hashed>
+void BM_find_right_hashed(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<K>::get(n);
+  using compare_right =
+      std::conditional_t<Hashed, intrusive::hashed<std::hash<K>>,
+                         std::less<K>>;
+  bimap<K, K, std::less<K>, compare_right> m;
+  for (size_t i = 0; i < n; i++)
+    m.insert(data.lefts[i], data.rights[i]);
+  std::vector<K> queries;
+  for (size_t i = 0; i < n; i++)
+    queries.push_back(i % 2 ? data.rights[i] : data.right_misses[i]);
+  for (auto _ : state) {
+    size_t found = 0;
+    for (auto const& key : queries)
+      found += m.find_right(key) != m.end_right();
+    benchmark::DoNotOptimize(found);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Выполняет query(m, key) для каждого ключа из keys(data).
+template <template <typename> class Impl, typename K, typename Keys,
+          typename Query>
+void run_queries(benchmark::State& state, Keys keys, Query query) {
+  size_t n = state.range(0);
+  auto const& data = dataset<K>::get(n);
+  auto m = build<Impl>(data);
+  auto const& queries = keys(data);
+  for (auto _ : state) {
+    size_t found = 0;
+    for (auto const& key : queries)
+      found += query(m, key);
+    benchmark::DoNotOptimize(found);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <template <typename> class Impl, typename K>
+void BM_find_left_hit(benchmark::State& state) {
+  run_queries<Impl, K>(
+      state, [](auto const& d) -> auto const& { return d.lefts; },
+      [](auto const& m, K const& k) { return Impl<K>::has_left(m, k); });
+}
+template <template <typename> class Impl, typename K>
+void BM_find_left_miss(benchmark::State& state) {
+  run_queries<Impl, K>(
+      state, [](auto const& d) -> auto const& { return d.left_misses; },
+      [](auto const& m, K const& k) { return Impl<K>::has_left(m, k); });
+}
+template <template <typename> class Impl, typename K>
+void BM_find_right_hit(benchmark::State& state) {
+  run_queries<Impl, K>(
+      state, [](auto const& d) -> auto const& { return d.rights; },
+      [](auto const& m, K const& k) { return Impl<K>::has_right(m, k); });
+}
+template <template <typename> class Impl, typename K>
+void BM_find_right_miss(benchmark::State& state) {
+  run_queries<Impl, K>(
+      state, [](auto const& d) -> auto const& { return d.right_misses; },
+      [](auto const& m, K const& k) { return Impl<K>::has_right(m, k); });
+}
+template <template <typename> class Impl, typename K>
+void BM_lower_bound(benchmark::State& state) {
+  run_queries<Impl, K>(
+      state, [](auto const& d) -> auto const& { return d.left_misses; },
+      [](auto const& m, K const& k) {
+        return Impl<K>::lower_bound_left(m, k);
+      });
+}
+template <template <typename> class Impl, typename K>
+void BM_upper_bound(benchmark::State& state) {
+  run_queries<Impl, K>(
+      state, [](auto const& d) -> auto const& { return d.lefts; },
+      [](auto const& m, K const& k) {
+        return Impl<K>::upper_bound_left(m, k);
+      });
+}
+
+template <template <typename> class Impl, typename K>
+void BM_erase_key(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<K>::get(n);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto* m = new auto(build<Impl>(data));
+    state.ResumeTiming();
+    for (auto const& key : data.lefts)
+      Impl<K>::erase_left(*m, key);
+    state.PauseTiming();
+    delete m;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <template <typename> class Impl, typename K>
+void BM_erase_iterator(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<K>::get(n);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto* m = new auto(build<Impl>(data));
+    state.ResumeTiming();
+    for (size_t i = 0; i < n; i++)
+      Impl<K>::erase_first(*m);
+    state.PauseTiming();
+    delete m;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <template <typename> class Impl, typename K>
+void BM_iterate_left(benchmark::State& state) {
+  auto m = build<Impl>(dataset<K>::get(state.range(0)));
+  for (auto _ : state) {
+    size_t count = 0;
+    Impl<K>::for_each_left(m, [&](K const& k) {
+      benchmark::DoNotOptimize(&k);
+      count++;
+    });
+    benchmark::DoNotOptimize(count);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <template <typename> class Impl, typename K>
+void BM_iterate_right(benchmark::State& state) {
+  auto m = build<Impl>(dataset<K>::get(state.range(0)));
+  for (auto _ : state) {
+    size_t count = 0;
+    Impl<K>::for_each_right(m, [&](K const& k) {
+      benchmark::DoNotOptimize(&k);
+      count++;
+    });
+    benchmark::DoNotOptimize(count);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <template <typename> class Impl, typename K>
+void BM_copy(benchmark::State& state) {
+  auto m = build<Impl>(dataset<K>::get(state.range(0)));
+  for (auto _ : state) {
+    auto* copy = new auto(m);
+    benchmark::DoNotOptimize(copy);
+    state.PauseTiming();
+    delete copy;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <template <typename> class Impl, typename K>
+void BM_swap(benchmark::State& state) {
+  auto const& data = dataset<K>::get(state.range(0));
+  auto a = build<Impl>(data);
+  typename Impl<K>::map_t b;
+  for (auto _ : state) {
+    a.swap(b);
+    benchmark::DoNotOptimize(&a);
+  }
+}
+
+template <template <typename> class Impl, typename K>
+void BM_destroy(benchmark::State& state) {
+  auto const& data = dataset<K>::get(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto* m = new auto(build<Impl>(data));
+    state.ResumeTiming();
+    delete m;
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename Allocator>
+using alloc_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                          intrusive::avl_balance, Allocator>;
+
+// Вставки и удаления вперемешку: размер bimap держится около n.
+template <typename Allocator>
+void BM_churn(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<int>::get(2 * n);
+  for (auto _ : state) {
+    alloc_bimap<Allocator> b;
+    for (size_t i = 0; i < n; i++)
+      b.insert(data.lefts[i], data.rights[i]);
+    for (size_t i = n; i < 2 * n; i++) {
+      b.erase_left(data.lefts[i - n]);
+      b.insert(data.lefts[i], data.rights[i]);
+    }
+    benchmark::DoNotOptimize(b.size());
+  }
+  state.SetItemsProcessed(state.iterations() * 3 * n);
+}
+
+// Поиск из многих потоков при одном писателе: поток 0 на каждые 64 поиска
+// делает одно изменение. Left-Right против bimap под std::shared_mutex.
+template <bool LeftRight>
+void BM_concurrent_find(benchmark::State& state) {
+  constexpr size_t n = 100000;
+  struct shared_map {
+    bimap<int, int> map;
+    std::shared_mutex mutex;
+  };
+  using map_t =
+      std::conditional_t<LeftRight, concurrent_bimap<int, int>, shared_map>;
+  static map_t* m = nullptr;
+  auto const& data = dataset<int>::get(n);
+  if (state.thread_index() == 0) {
+    m = new map_t;
+    for (size_t i = 0; i < n; i++) {
+      if constexpr (LeftRight)
+        m->insert(data.lefts[i], data.rights[i]);
+      else
+        m->map.insert(data.lefts[i], data.rights[i]);
+    }
+  }
+  std::mt19937 e(state.thread_index());
+  size_t found = 0, step = 0;
+  for (auto _ : state) {
+    int key = data.lefts[e() % n];
+    if constexpr (LeftRight) {
+      found += m->find_left(key).has_value();
+    } else {
+      std::shared_lock lock(m->mutex);
+      found += m->map.find_left(key) != m->map.end_left();
+    }
+    if (state.thread_index() == 0 && ++step % 64 == 0) {
+      int erased = data.lefts[e() % n];
+      if constexpr (LeftRight) {
+        auto right = m->find_left(erased);
+        if (right) {
+          m->erase_left(erased);
+          m->insert(erased, *right);
+        }
+      } else {
+        std::unique_lock lock(m->mutex);
+        auto it = m->map.find_left(erased);
+        int right = *it.flip();
+        m->map.erase_left(it);
+        m->map.insert(erased, right);
+      }
+    }
+  }
+  benchmark::DoNotOptimize(found);
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete m;
+    m = nullptr;
+  }
+}
+
+// Многие писатели: range(0) процентов операций -- вставки и удаления
+// поровну, остальное -- поиск. Потоки работают со своими диапазонами
+// ключей. sharded_bimap против bimap под одним мьютексом.
+template <bool Sharded>
+void BM_multi_writer(benchmark::State& state) {
+  struct locked_map {
+    bimap<int, int> map;
+    std::mutex mutex;
+
+    bool insert(int l, int r) {
+      std::lock_guard lock(mutex);
+      return map.insert(l, r) != map.end_left();
+    }
+    bool erase_left(int l) {
+      std::lock_guard lock(mutex);
+      return map.erase_left(l);
+    }
+    bool find_left(int l) {
+      std::lock_guard lock(mutex);
+      return map.find_left(l) != map.end_left();
+    }
+  };
+  using map_t = std::conditional_t<Sharded, sharded_bimap<int, int>,
+                                   locked_map>;
+  constexpr int keys_per_thread = 1 << 16;
+  static map_t* m = nullptr;
+  if (state.thread_index() == 0)
+    m = new map_t;
+  unsigned percent = state.range(0);
+  int base = state.thread_index() * keys_per_thread;
+  std::mt19937 e(state.thread_index());
+  size_t found = 0;
+  for (auto _ : state) {
+    int key = base + e() % keys_per_thread;
+    unsigned op = e() % 100;
+    if (op < percent / 2)
+      found += m->insert(key, -key);
+    else if (op < percent)
+      found += m->erase_left(key);
+    else if constexpr (Sharded)
+      found += m->find_left(key).has_value();
+    else
+      found += m->find_left(key);
+  }
+  benchmark::DoNotOptimize(found);
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete m;
+    m = nullptr;
+  }
+}
+
+// Отделение нижней четверти по left: split_left против переноса по
+// одной паре через erase_left и insert.
+template <bool Split>
+void BM_split_left(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<int>::get(n);
+  auto m = build<bimap_impl>(data);
+  int watermark = *std::next(m.begin_left(), n / 4);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto b = m;
+    state.ResumeTiming();
+    bimap<int, int> low;
+    if constexpr (Split) {
+      low = b.split_left(watermark);
+    } else {
+      while (b.front_left() < watermark) {
+        auto it = b.begin_left();
+        low.insert(*it, *it.flip());
+        b.erase_left(it);
+      }
+    }
+    benchmark::DoNotOptimize(low.size());
+    state.PauseTiming();
+    b.clear();
+    low.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * (n / 4));
+}
+
+// Цена включенной статистики: поиск всех ключей и полный обход в bimap с
+// intrusive::counting_stats против bimap без нее.
+template <bool Counting>
+void BM_stats_overhead(benchmark::State& state) {
+  using stats_t =
+      std::conditional_t<Counting, intrusive::counting_stats,
+                         intrusive::no_stats>;
+  using map_t = bimap<int, int, std::less<int>, std::less<int>,
+                      intrusive::avl_balance,
+                      std::allocator<std::pair<int, int>>,
+                      intrusive::no_augment, stats_t>;
+  size_t n = state.range(0);
+  auto const& data = dataset<int>::get(n);
+  map_t m;
+  for (size_t i = 0; i < n; i++)
+    m.insert(data.lefts[i], data.rights[i]);
+  std::vector<int> queries(data.lefts);
+  std::shuffle(queries.begin(), queries.end(), std::mt19937(n));
+  for (auto _ : state) {
+    for (int q : queries)
+      benchmark::DoNotOptimize(m.find_left(q));
+    for (auto it = m.begin_right(); it != m.end_right(); ++it)
+      benchmark::DoNotOptimize(*it);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Поиск строковых ключей с общим префиксом: std::less против
+// std::compare_three_way, сравнивающего ключ с узлом за один вызов.
+template <bool ThreeWay>
+void BM_find_three_way(benchmark::State& state) {
+  using compare_t =
+      std::conditional_t<ThreeWay, std::compare_three_way, std::less<>>;
+  size_t n = state.range(0);
+  auto const& data = dataset<std::string>::get(n);
+  bimap<std::string, std::string, compare_t, compare_t> m;
+  for (size_t i = 0; i < n; i++)
+    m.insert(data.lefts[i], data.rights[i]);
+  std::vector<std::string> queries(data.lefts);
+  std::shuffle(queries.begin(), queries.end(), std::mt19937(n));
+  for (auto _ : state) {
+    for (auto const& q : queries)
+      benchmark::DoNotOptimize(m.find_left(q));
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Смена right у случайных пар на новые возрастающие id: erase и insert
+// против replace_right.
+template <bool Replace>
+void BM_rekey_right(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<int>::get(n);
+  auto m = build<bimap_impl>(data);
+  std::vector<int> lefts(data.lefts);
+  std::shuffle(lefts.begin(), lefts.end(), std::mt19937(n));
+  int next_id = *std::max_element(data.rights.begin(), data.rights.end());
+  size_t i = 0;
+  for (auto _ : state) {
+    int left = lefts[i++ % n];
+    if constexpr (Replace) {
+      m.replace_right(m.find_left(left), ++next_id);
+    } else {
+      m.erase_left(left);
+      m.insert(left, ++next_id);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Upsert случайных пар в полный bimap: erase_left, erase_right и insert
+// против insert_or_assign_left.
+template <bool Fused>
+void BM_upsert(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<int>::get(n);
+  auto m = build<bimap_impl>(data);
+  std::mt19937 e(n);
+  std::vector<std::pair<int, int>> ops(n);
+  for (auto& [left, right] : ops) {
+    left = data.lefts[e() % n];
+    right = data.rights[e() % n];
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    auto [left, right] = ops[i++ % n];
+    if constexpr (Fused) {
+      m.insert_or_assign_left(left, right);
+    } else {
+      m.erase_left(left);
+      m.erase_right(right);
+      m.insert(left, right);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Поиск в bimap, пары которого были удалены и вставлены заново пачками
+// вперемешку, без compact_left и после него.
+template <bool Compacted>
+void BM_find_churned(benchmark::State& state) {
+  size_t n = state.range(0);
+  auto const& data = dataset<int>::get(n);
+  auto m = build<bimap_impl>(data);
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), std::mt19937(n));
+  for (size_t i = 0; i < n; i += 1024) {
+    size_t last = std::min(n, i + 1024);
+    for (size_t j = i; j < last; j++)
+      m.erase_left(data.lefts[order[j]]);
+    for (size_t j = last; j-- > i;)
+      m.insert(data.lefts[order[j]], data.rights[order[j]]);
+  }
+  if constexpr (Compacted)
+    m.compact_left();
+  std::vector<int> queries(data.lefts);
+  std::shuffle(queries.begin(), queries.end(), std::mt19937(n + 1));
+  size_t i = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(m.find_left(queries[i++ % n]));
+  state.SetItemsProcessed(state.iterations());
+}
+
+void sizes(benchmark::internal::Benchmark* b) {
+  b->RangeMultiplier(10)->Range(1000, 10000000);
+}
+
+} // namespace
+
+#define BIMAP_BENCHMARK_IMPL(op, impl)                                         \
+  BENCHMARK_TEMPLATE(op, impl, int)->Apply(sizes);                             \
+  BENCHMARK_TEMPLATE(op, impl, std::string)->Apply(sizes);                     \
+  BENCHMARK_TEMPLATE(op, impl, struct64)->Apply(sizes)
+
+#ifdef HAVE_BOOST_BIMAP
+#define BIMAP_BENCHMARK(op)                                                    \
+  BIMAP_BENCHMARK_IMPL(op, bimap_impl);                                        \
+  BIMAP_BENCHMARK_IMPL(op, compact_impl);                                      \
+  BIMAP_BENCHMARK_IMPL(op, two_maps_impl);                                     \
+  BIMAP_BENCHMARK_IMPL(op, boost_impl)
+#else
+#define BIMAP_BENCHMARK(op)                                                    \
+  BIMAP_BENCHMARK_IMPL(op, bimap_impl);                                        \
+  BIMAP_BENCHMARK_IMPL(op, compact_impl);                                      \
+  BIMAP_BENCHMARK_IMPL(op, two_maps_impl)
+#endif
+
+BIMAP_BENCHMARK(BM_insert_random);
+BIMAP_BENCHMARK(BM_insert_sorted);
+BIMAP_BENCHMARK(BM_insert_reverse);
+BIMAP_BENCHMARK(BM_find_left_hit);
+BIMAP_BENCHMARK(BM_find_left_miss);
+BIMAP_BENCHMARK(BM_find_right_hit);
+BIMAP_BENCHMARK(BM_find_right_miss);
+BIMAP_BENCHMARK(BM_lower_bound);
+BIMAP_BENCHMARK(BM_upper_bound);
+BIMAP_BENCHMARK(BM_erase_key);
+BIMAP_BENCHMARK(BM_erase_iterator);
+BIMAP_BENCHMARK(BM_iterate_left);
+BIMAP_BENCHMARK(BM_iterate_right);
+BIMAP_BENCHMARK(BM_copy);
+BIMAP_BENCHMARK(BM_swap);
+BIMAP_BENCHMARK(BM_destroy);
+
+BENCHMARK_TEMPLATE(BM_append_sorted, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_append_sorted, true)->Apply(sizes);
+
+BENCHMARK_TEMPLATE(BM_find_left_batch, false)
+    ->RangeMultiplier(8)
+    ->Range(1 << 14, 1 << 23);
+BENCHMARK_TEMPLATE(BM_find_left_batch, true)
+    ->RangeMultiplier(8)
+    ->Range(1 << 14, 1 << 23);
+
+BENCHMARK_TEMPLATE(BM_frozen, int, false, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen, int, true, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen, int, false, true)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen, int, true, true)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen, std::string, false, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen, std::string, true, false)->Apply(sizes);
+
+BENCHMARK_TEMPLATE(BM_find_right_hashed, int, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_find_right_hashed, int, true)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_find_right_hashed, std::string, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_find_right_hashed, std::string, true)->Apply(sizes);
+
+BENCHMARK_TEMPLATE(BM_concurrent_find, false)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_concurrent_find, true)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_multi_writer, false)
+    ->ArgsProduct({{0, 50, 100}})
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_multi_writer, true)
+    ->ArgsProduct({{0, 50, 100}})
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_split_left, false)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(BM_split_left, true)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+
+BENCHMARK_TEMPLATE(BM_stats_overhead, false)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(BM_stats_overhead, true)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+
+BENCHMARK_TEMPLATE(BM_find_three_way, false)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(BM_find_three_way, true)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+
+BENCHMARK_TEMPLATE(BM_rekey_right, false)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(BM_rekey_right, true)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+
+BENCHMARK_TEMPLATE(BM_upsert, false)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(BM_upsert, true)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+
+BENCHMARK_TEMPLATE(BM_find_churned, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_find_churned, true)->Apply(sizes);
+
+BENCHMARK_TEMPLATE(BM_churn, std::allocator<int>)
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000);
+BENCHMARK_TEMPLATE(BM_churn, pool_allocator<int>)
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000);
+BENCHMARK_TEMPLATE(BM_churn, compact_allocator<int>)
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000);
+
+BENCHMARK_MAIN();
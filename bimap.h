@@ -3,22 +3,48 @@
 #include "bimap_details.h"
 #include "intrusive_tree.h"
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
+          typename CompareRight = std::less<Right>,
+          typename Balance = intrusive::avl_balance,
+          typename Allocator = std::allocator<std::pair<Left, Right>>,
+          typename Augment = intrusive::no_augment,
+          typename Stats = intrusive::no_stats>
 class bimap {
   using left_t = Left;
   using right_t = Right;
   using left_tag = details::left_tag;
   using right_tag = details::right_tag;
-  using node_t = details::node_t<Left, Right>;
+  using links_t = typename details::links_of<Allocator>::type;
+  using node_t = details::node_t<Left, Right, Augment, links_t>;
+  using l_key_t = details::key_t<Left, left_tag, Augment, links_t>;
+  using r_key_t = details::key_t<Right, right_tag, Augment, links_t>;
+  template <typename Tag>
+  using tree_node_t = intrusive::node<Tag, links_t>;
+  using node_allocator_t = typename std::allocator_traits<
+      Allocator>::template rebind_alloc<node_t>;
+  using node_traits = std::allocator_traits<node_allocator_t>;
+  using sink_t = intrusive::stats_sink<Stats>;
 
+  // Дерево или, для intrusive::hashed, хеш-индекс стороны.
   template <typename Base, typename Compare, typename Tag>
   using intrusive_tree =
-      intrusive::intrusive_tree<details::key_t<Base, Tag>, Compare, Tag>;
+      typename details::side_index<Base, Compare, Tag, Balance, Augment,
+                                   links_t, Stats>::type;
 
   using l_comparator_t = CompareLeft;
   using r_comparator_t = CompareRight;
@@ -28,12 +54,17 @@ class bimap {
   l_tree_t left_tree;
   r_tree_t right_tree;
   size_t n_node = 0;
+  [[no_unique_address]] node_allocator_t alloc;
+  // Статистика: деревья и их итераторы пишут сюда. При swap и
+  // перемещении переходит вместе с парами.
+  [[no_unique_address]] details::stats_storage<Stats> stats_data;
 
   template <typename Base, typename Pair, typename CompareBase,
             typename ComparePair, typename TagBase, typename TagPair>
   struct base_iterator {
     typename intrusive_tree<Base, CompareBase, TagBase>::iterator it_tree;
 
+    base_iterator() = default;
     explicit base_iterator(
         typename intrusive_tree<Base, CompareBase, TagBase>::iterator it_tree)
         : it_tree(it_tree) {}
@@ -98,16 +129,21 @@ class bimap {
         return base_iterator<Pair, Base, ComparePair, CompareBase, TagPair,
                              TagBase>(
             typename intrusive_tree<Pair, ComparePair, TagPair>::iterator(
-                reinterpret_cast<intrusive::node<TagPair>*>(it_tree->right)));
+                reinterpret_cast<tree_node_t<TagPair>*>(
+                    static_cast<tree_node_t<TagBase>*>(
+                        it_tree.get_node()->right)),
+                it_tree.get_stats()));
 
       return base_iterator<Pair, Base, ComparePair, CompareBase, TagPair,
                            TagBase>(
           typename intrusive_tree<Pair, ComparePair, TagPair>::iterator(
-              static_cast<details::node_t<Left, Right>*>(&(*it_tree))));
+              static_cast<node_t*>(&(*it_tree)), it_tree.get_stats()));
     }
   };
 
 public:
+  using allocator_type = Allocator;
+
   using left_iterator =
       base_iterator<Left, Right, l_comparator_t, r_comparator_t,
                     details::left_tag, details::right_tag>;
@@ -115,19 +151,101 @@ public:
       base_iterator<Right, Left, r_comparator_t, l_comparator_t,
                     details::right_tag, details::left_tag>;
 
+  // Владеющий handle пары, вынутой из bimap, как node_type у std::map.
+  // Узел переходит между bimap'ами с равными аллокаторами без выделения
+  // памяти и копирования ключей. Непустой handle освобождает узел в
+  // деструкторе.
+  class node_type {
+    node_t* node = nullptr;
+    std::optional<node_allocator_t> alloc;
+
+    friend class bimap;
+
+    node_type(node_t* node, node_allocator_t const& alloc)
+        : node(node), alloc(alloc) {}
+
+    void reset() noexcept {
+      if (node) {
+        node_traits::destroy(*alloc, node);
+        node_traits::deallocate(*alloc, node, 1);
+        node = nullptr;
+      }
+      alloc.reset();
+    }
+
+  public:
+    using allocator_type = Allocator;
+
+    node_type() = default;
+
+    node_type(node_type&& other) noexcept
+        : node(std::exchange(other.node, nullptr)),
+          alloc(std::move(other.alloc)) {
+      other.alloc.reset();
+    }
+
+    node_type& operator=(node_type&& other) noexcept {
+      if (this != &other) {
+        reset();
+        node = std::exchange(other.node, nullptr);
+        alloc = std::move(other.alloc);
+        other.alloc.reset();
+      }
+      return *this;
+    }
+
+    ~node_type() {
+      reset();
+    }
+
+    bool empty() const noexcept {
+      return node == nullptr;
+    }
+    explicit operator bool() const noexcept {
+      return node != nullptr;
+    }
+
+    // Ключи пары. Пока пара вне bimap, их можно менять. Для пустого
+    // handle неопределены.
+    left_t& left() const {
+      return static_cast<l_key_t*>(node)->key;
+    }
+    right_t& right() const {
+      return static_cast<r_key_t*>(node)->key;
+    }
+
+    allocator_type get_allocator() const {
+      return allocator_type(*alloc);
+    }
+
+    void swap(node_type& other) noexcept {
+      std::swap(node, other.node);
+      std::swap(alloc, other.alloc);
+    }
+  };
+
+  // Результат insert(node_type&&): при неудаче node по-прежнему владеет
+  // парой, а position указывает на пару, помешавшую вставке.
+  struct insert_return_type {
+    left_iterator position;
+    bool inserted;
+    node_type node;
+  };
+
   void link_sentinel() {
     right_tree.get_sentinel()->right =
-        reinterpret_cast<intrusive::node<right_tag>*>(left_tree.get_sentinel());
+        reinterpret_cast<tree_node_t<right_tag>*>(left_tree.get_sentinel());
     left_tree.get_sentinel()->right =
-        reinterpret_cast<intrusive::node<left_tag>*>(right_tree.get_sentinel());
+        reinterpret_cast<tree_node_t<left_tag>*>(right_tree.get_sentinel());
   }
 
+  // Если аллокатор не переходит при swap, аллокаторы должны быть равны.
   void swap(bimap& other) {
-    left_tree.swap(other.left_tree);
-    right_tree.swap(other.right_tree);
-    std::swap(n_node, other.n_node);
-    link_sentinel();
-    other.link_sentinel();
+    if constexpr (node_traits::propagate_on_container_swap::value)
+      std::swap(alloc, other.alloc);
+    else
+      assert(alloc == other.alloc);
+    swap_nodes(other);
   }
 
   // Возващает итератор на минимальный по порядку left.
@@ -139,6 +257,19 @@ public:
     return left_iterator(left_tree.end());
   }
 
+  // Минимальный и максимальный left за O(1).
+  // Для пустого bimap неопределены.
+  left_t const& front_left() const
+    requires l_tree_t::ordered
+  {
+    return *begin_left();
+  }
+  left_t const& back_left() const
+    requires l_tree_t::ordered
+  {
+    return *left_iterator(left_tree.last());
+  }
+
   // Возващает итератор на минимальный по порядку right.
   right_iterator begin_right() const {
     return right_iterator(right_tree.begin());
@@ -148,41 +279,105 @@ public:
     return right_iterator(right_tree.end());
   }
 
+  // Минимальный и максимальный right за O(1).
+  // Для пустого bimap неопределены.
+  right_t const& front_right() const
+    requires r_tree_t::ordered
+  {
+    return *begin_right();
+  }
+  right_t const& back_right() const
+    requires r_tree_t::ordered
+  {
+    return *right_iterator(right_tree.last());
+  }
+
   // Создает bimap не содержащий ни одной пары.
+  // Узлы пар выделяются через allocator, приведенный к типу узла.
   explicit bimap(CompareLeft compare_left = CompareLeft(),
-                 CompareRight compare_right = CompareRight())
+                 CompareRight compare_right = CompareRight(),
+                 Allocator const& allocator = Allocator())
       : left_tree(std::move(l_comparator_t(std::move(compare_left)))),
-        right_tree(std::move(r_comparator_t(std::move(compare_right)))) {
+        right_tree(std::move(r_comparator_t(std::move(compare_right)))),
+        alloc(allocator) {
     link_sentinel();
+    attach_stats();
   }
 
-  // Конструкторы от других и присваивания
-  bimap(bimap const& other)
-      : left_tree(static_cast<l_comparator_t>(other.left_tree)),
-        right_tree(static_cast<r_comparator_t>(other.right_tree))
-  ///,n_node(0) - because insert
+  // Создает bimap из пар [first, last) за O(n log n) сравнений. Остаются
+  // те же пары, что и при вставке их по очереди через insert.
+  template <std::input_iterator InputIt>
+  bimap(InputIt first, InputIt last, CompareLeft compare_left = CompareLeft(),
+        CompareRight compare_right = CompareRight(),
+        Allocator const& allocator = Allocator())
+      : bimap(std::move(compare_left), std::move(compare_right), allocator) {
+    build_from(first, last, false);
+  }
+
+  // Как конструктор от ренжа, но пары уже упорядочены по left. Деревья
+  // строятся идеально сбалансированными за линейное время после одной
+  // сортировки по right.
+  template <std::input_iterator InputIt>
+  static bimap from_sorted(InputIt first, InputIt last,
+                           CompareLeft compare_left = CompareLeft(),
+                           CompareRight compare_right = CompareRight(),
+                           Allocator const& allocator = Allocator())
+    requires l_tree_t::ordered
   {
-    link_sentinel();
-    for (auto it = other.begin_left(); it != other.end_left(); it++) {
-      this->insert(*it, *(it.flip()));
-    }
+    bimap res(std::move(compare_left), std::move(compare_right), allocator);
+    res.build_from(first, last, true);
+    return res;
   }
-  bimap(bimap&& other) noexcept
-      : left_tree(static_cast<l_comparator_t>(other.left_tree)),
-        right_tree(static_cast<r_comparator_t>(other.right_tree)),
-        n_node(other.n_node) {
-    left_tree.swap(other.left_tree);
-    right_tree.swap(other.right_tree);
+
+  // Конструкторы от других и присваивания
+  bimap(bimap const& other)
+      : bimap(copy_nodes, other,
+              node_traits::select_on_container_copy_construction(
+                  other.alloc)) {}
+  // Перемещение выделяет память под новую статистику other, а с
+  // compact_links -- и под новые sentinel'ы.
+  bimap(bimap&& other) noexcept(nothrow_move) : bimap(empty_like, other) {
+    swap(other);
   }
 
+  // Аллокатор переходит из other, только если этого требуют его
+  // propagate_on_container_*_assignment.
   bimap& operator=(bimap const& other) {
-    if (this != &other)
-      bimap(other).swap(*this);
+    if (this == &other)
+      return *this;
+    constexpr bool propagate =
+        node_traits::propagate_on_container_copy_assignment::value;
+    bimap tmp(copy_nodes, other, propagate ? other.alloc : alloc);
+    swap_nodes(tmp);
+    if constexpr (propagate)
+      std::swap(alloc, tmp.alloc);
     return *this;
   }
-  bimap& operator=(bimap&& other) noexcept {
-    if (this != &other)
-      bimap(std::move(other)).swap(*this);
+  // Если аллокатор не переходит и не равен аллокатору other, пары
+  // переносятся поштучно в узлы из своего аллокатора.
+  bimap& operator=(bimap&& other) noexcept(nothrow_move &&
+                                           move_assign_steals_nodes) {
+    if (this == &other)
+      return *this;
+    if constexpr (!move_assign_steals_nodes) {
+      if (alloc != other.alloc) {
+        // Ключи other перемещены, даже если копия не достроилась, так что
+        // other очищается в любом случае.
+        try {
+          bimap tmp(copy_nodes, std::move(other), alloc);
+          other.clear();
+          swap_nodes(tmp);
+        } catch (...) {
+          other.clear();
+          throw;
+        }
+        return *this;
+      }
+    }
+    bimap tmp(std::move(other));
+    swap_nodes(tmp);
+    if constexpr (node_traits::propagate_on_container_move_assignment::value)
+      std::swap(alloc, tmp.alloc);
     return *this;
   }
 
@@ -190,29 +385,609 @@ public:
   // Инвалидирует все итераторы ссылающиеся на элементы этого bimap
   // (включая итераторы ссылающиеся на элементы следующие за последними).
   ~bimap() {
-    auto it = begin_left();
+    clear();
+  }
 
-    while (it != end_left()) {
-      it = erase_left(it);
+  // Удаляет все пары за один обход без перебалансировки. Если аллокатор
+  // умеет освобождать свой пул целиком, а узлы не требуют деструкторов,
+  // обход не делается вовсе.
+  // Инвалидирует все итераторы, кроме end_left() и end_right().
+  void clear() noexcept {
+    if constexpr (std::is_trivially_destructible_v<node_t> &&
+                  requires(node_allocator_t& a) { a.release(); }) {
+      if (alloc.release()) {
+        sink().deallocated(n_node);
+        left_tree.reset();
+        right_tree.reset();
+        n_node = 0;
+        return;
+      }
     }
+    left_tree.clear_and_dispose([this](l_key_t* n) {
+      free_node(static_cast<node_t*>(n));
+    });
+    right_tree.reset();
+    n_node = 0;
   }
 
 private:
+  // Пустой bimap с компараторами и аллокатором узлов other, так что узлы
+  // можно переносить между ними. Аллокатор берется именно узловой:
+  // обратный ребинд из allocator_type не обязан дать равный.
+  struct empty_like_t {};
+  static constexpr empty_like_t empty_like{};
+
+  static constexpr bool nothrow_move =
+      !Stats::enabled && links_t::nothrow_sentinel;
+  // Перемещающее присваивание всегда может забрать узлы other.
+  static constexpr bool move_assign_steals_nodes =
+      node_traits::propagate_on_container_move_assignment::value ||
+      node_traits::is_always_equal::value;
+
+  bimap(empty_like_t, bimap const& other) noexcept(nothrow_move)
+      : left_tree(static_cast<l_comparator_t>(other.left_tree)),
+        right_tree(static_cast<r_comparator_t>(other.right_tree)),
+        alloc(other.alloc) {
+    link_sentinel();
+    attach_stats();
+  }
+
+  // Поузловая копия other с аллокатором узлов a. Если other передан как
+  // rvalue, ключи перемещаются из его узлов, и other остается только
+  // очистить.
+  struct copy_nodes_t {};
+  static constexpr copy_nodes_t copy_nodes{};
+
+  template <typename Other>
+  bimap(copy_nodes_t, Other&& other, node_allocator_t const& a)
+      : left_tree(static_cast<l_comparator_t>(other.left_tree)),
+        right_tree(static_cast<r_comparator_t>(other.right_tree)),
+        alloc(a) {
+    link_sentinel();
+    attach_stats();
+    std::size_t n = other.size();
+    if (n == 0)
+      return;
+    // Номер копии каждого узла other в by_left. Вместо хеш-таблицы с
+    // узлом на пару -- открытая адресация по адресу узла в одном векторе,
+    // заполненном не больше чем наполовину.
+    using position = std::pair<node_t const*, std::size_t>;
+    int bits = std::bit_width(2 * n);
+    std::size_t mask = (std::size_t(1) << bits) - 1;
+    std::vector<position> index(mask + 1);
+    auto slot = [bits](node_t const* old) {
+      auto x = static_cast<std::uint64_t>(
+          reinterpret_cast<std::uintptr_t>(old));
+      return static_cast<std::size_t>((x * 0x9E3779B97F4A7C15u) >> (64 - bits));
+    };
+    std::vector<node_t*> by_left;
+    std::vector<node_t*> by_right;
+    by_left.reserve(n);
+    by_right.reserve(n);
+    // Корзины хеш-индексов выделяются до узлов, чтобы build_trees не
+    // бросал.
+    prepare_link(n);
+    try {
+      for (auto it = other.left_tree.begin(); it != other.left_tree.end();
+           ++it) {
+        auto const* old = static_cast<node_t const*>(&*it);
+        std::size_t s = slot(old);
+        while (index[s].first != nullptr)
+          s = (s + 1) & mask;
+        index[s] = {old, by_left.size()};
+        if constexpr (std::is_const_v<std::remove_reference_t<Other>>) {
+          by_left.push_back(make_node(left_key(old), right_key(old)));
+        } else {
+          auto* src = const_cast<node_t*>(old);
+          by_left.push_back(
+              make_node(std::move(static_cast<l_key_t*>(src)->key),
+                        std::move(static_cast<r_key_t*>(src)->key)));
+        }
+      }
+    } catch (...) {
+      for (node_t* cur : by_left)
+        free_node(cur);
+      throw;
+    }
+    for (auto it = other.right_tree.begin(); it != other.right_tree.end();
+         ++it) {
+      auto const* old = static_cast<node_t const*>(&*it);
+      std::size_t s = slot(old);
+      while (index[s].first != old)
+        s = (s + 1) & mask;
+      by_right.push_back(by_left[index[s].second]);
+    }
+    build_trees(by_left, by_right);
+  }
+
+  // Обменивает пары и статистику, но не аллокаторы.
+  void swap_nodes(bimap& other) noexcept {
+    left_tree.swap(other.left_tree);
+    right_tree.swap(other.right_tree);
+    std::swap(n_node, other.n_node);
+    stats_data.swap(other.stats_data);
+    link_sentinel();
+    other.link_sentinel();
+    attach_stats();
+    other.attach_stats();
+  }
+
   template <typename lpf = left_t, typename rpf = right_t>
   left_iterator add(lpf&& left, rpf&& right) {
-    if (left_tree.template find<const left_t&>(left) == left_tree.end() &&
-        right_tree.template find<const right_t&>(right) == right_tree.end()) {
-      auto* new_node =
-          new node_t{std::forward<lpf>(left), std::forward<rpf>(right)};
-      typename l_tree_t::iterator iter_left_tree =
-          left_tree.template insert<const left_t&>(*new_node);
-      right_tree.template insert<const right_t&>(*new_node);
+    return add_probed(left, right, std::forward<lpf>(left),
+                      std::forward<rpf>(right));
+  }
+
+  // Ищет left_probe и right_probe и только если обоих нет, создает узел из
+  // node_args. С CheckKeys отладочная сборка проверяет, что ключи
+  // созданного узла равны пробам: иначе узел встал бы не на свое место.
+  template <bool CheckKeys = false, typename LK, typename RK,
+            typename... Args>
+  left_iterator add_probed(LK const& left_probe, RK const& right_probe,
+                           Args&&... node_args) {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::insert);
+    auto l_pos = left_tree.find_with_result(left_probe);
+    if (l_pos.flag == l_tree_t::find_result::THERE_IS)
+      return end_left();
+    auto r_pos = right_tree.find_with_result(right_probe);
+    if (r_pos.flag == r_tree_t::find_result::THERE_IS)
+      return end_left();
+
+    node_t* new_node = make_node(std::forward<Args>(node_args)...);
+    if constexpr (CheckKeys) {
+      assert(left_tree.matches(left_key(new_node), left_probe));
+      assert(right_tree.matches(right_key(new_node), right_probe));
+    }
+    return link_node(new_node, l_pos, r_pos);
+  }
+
+  template <typename lpf, typename rpf>
+  left_iterator add_hinted(left_iterator hint_left, right_iterator hint_right,
+                           lpf&& left, rpf&& right) {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::insert);
+    auto l_pos = left_tree.find_with_hint(hint_left.it_tree, left);
+    if (l_pos.flag == l_tree_t::find_result::THERE_IS)
+      return end_left();
+    auto r_pos = right_tree.find_with_hint(hint_right.it_tree, right);
+    if (r_pos.flag == r_tree_t::find_result::THERE_IS)
+      return end_left();
+
+    node_t* new_node =
+        make_node(std::forward<lpf>(left), std::forward<rpf>(right));
+    return link_node(new_node, l_pos, r_pos);
+  }
+
+  // Забирает new_node: если подготовить индексы не удалось, узел
+  // освобождается.
+  left_iterator link_node(node_t* new_node,
+                          typename l_tree_t::find_result l_pos,
+                          typename r_tree_t::find_result r_pos) {
+    try {
+      prepare_link();
+    } catch (...) {
+      free_node(new_node);
+      throw;
+    }
+    return link_prepared(new_node, l_pos, r_pos);
+  }
+
+  // Хеш-индексы выделяют память под корзины заранее, чтобы вставка в
+  // одну сторону не осталась без вставки в другую.
+  void prepare_link(std::size_t count = 1) {
+    if constexpr (!l_tree_t::ordered)
+      left_tree.reserve(n_node + count);
+    if constexpr (!r_tree_t::ordered)
+      right_tree.reserve(n_node + count);
+  }
+
+  // Не бросает исключений после prepare_link.
+  left_iterator link_prepared(node_t* n, typename l_tree_t::find_result l_pos,
+                              typename r_tree_t::find_result r_pos) {
+    typename l_tree_t::iterator iter_left_tree =
+        left_tree.insert_at(l_pos, *n);
+    right_tree.insert_at(r_pos, *n);
+
+    n_node++;
+
+    return left_iterator(iter_left_tree);
+  }
+
+  // Отцепляет узел от обоих деревьев, не освобождая его.
+  void unlink_node(node_t* n) {
+    left_tree.unlink(n);
+    right_tree.unlink(n);
+    n_node--;
+  }
+
+  void attach_stats() {
+    left_tree.set_stats(stats_data.get());
+    right_tree.set_stats(stats_data.get());
+  }
+
+  sink_t sink() const {
+    return sink_t(stats_data.get());
+  }
+
+  // Делает new_key ключом стороны Base узла n, см. replace_right.
+  template <typename Base, typename Tree, typename Key>
+  static bool rekey(Tree& tree, node_t* n, Key& new_key) {
+    Base* side = n;
+    auto pos = tree.find_with_result(new_key);
+    if (pos.flag == Tree::find_result::THERE_IS) {
+      if (pos.node != side)
+        return false;
+      side->key = std::move(new_key);
+      return true;
+    }
+    tree.relocate(side, pos, [&] { side->key = std::move(new_key); });
+    return true;
+  }
+
+  // Ключи можно переписывать в узлах, не рискуя исключением посреди
+  // перевешивания.
+  static constexpr bool nothrow_rekey =
+      std::is_nothrow_move_assignable_v<left_t> &&
+      std::is_nothrow_move_assignable_v<right_t>;
+
+  template <bool ByLeft>
+  auto& side_tree() {
+    if constexpr (ByLeft)
+      return left_tree;
+    else
+      return right_tree;
+  }
+
+  // Общая часть insert_or_assign_left и insert_or_assign_right: ByLeft
+  // говорит, на какой стороне key, own_pos -- результат поиска key.
+  // Возвращает узел пары (key, value) и то, не было ли key.
+  template <bool ByLeft, typename OwnPos, typename K, typename V>
+  std::pair<node_t*, bool> assign_pair(OwnPos own_pos, K& key, V& value) {
+    auto& own = side_tree<ByLeft>();
+    auto& other = side_tree<!ByLeft>();
+    using own_key_t = std::conditional_t<ByLeft, l_key_t, r_key_t>;
+    using other_key_t = std::conditional_t<ByLeft, r_key_t, l_key_t>;
+    using own_result = typename std::remove_cvref_t<decltype(own)>::find_result;
+    using other_result =
+        typename std::remove_cvref_t<decltype(other)>::find_result;
+
+    auto other_pos = other.find_with_result(value);
+    node_t* a = own_pos.flag == own_result::THERE_IS
+                    ? static_cast<node_t*>(
+                          static_cast<own_key_t*>(own_pos.node))
+                    : nullptr;
+    node_t* b = other_pos.flag == other_result::THERE_IS
+                    ? static_cast<node_t*>(
+                          static_cast<other_key_t*>(other_pos.node))
+                    : nullptr;
+    if (a == nullptr && b == nullptr) {
+      node_t* n;
+      if constexpr (ByLeft) {
+        n = make_node(std::move(key), std::move(value));
+        link_node(n, own_pos, other_pos);
+      } else {
+        n = make_node(std::move(value), std::move(key));
+        link_node(n, other_pos, own_pos);
+      }
+      return {n, true};
+    }
+    if (a == b)
+      return {a, false};
+    if (a == nullptr) {
+      own.relocate(b, own_pos, [&] {
+        static_cast<own_key_t*>(b)->key = std::move(key);
+      });
+      return {b, true};
+    }
+    if (b != nullptr) {
+      other_pos = other.unlink_to_slot(b);
+      own.unlink(b);
+      n_node--;
+      free_node(b);
+    }
+    other.relocate(a, other_pos, [&] {
+      static_cast<other_key_t*>(a)->key = std::move(value);
+    });
+    return {a, false};
+  }
 
-      n_node++;
+  // Общая часть compact_left и compact_right: узлы раскладываются по
+  // дереву стороны ByLeft.
+  template <bool ByLeft>
+  void compact_by(intrusive::node_layout layout) {
+    using own_tag = std::conditional_t<ByLeft, left_tag, right_tag>;
+    using own_key_t = std::conditional_t<ByLeft, l_key_t, r_key_t>;
+    using own_tree_t = std::remove_cvref_t<decltype(side_tree<ByLeft>())>;
 
-      return left_iterator(iter_left_tree);
+    std::vector<node_t*> by_left = collect(left_tree.begin(),
+                                           left_tree.end());
+    std::vector<node_t*> by_right = collect(right_tree.begin(),
+                                            right_tree.end());
+    std::vector<node_t*>& own = ByLeft ? by_left : by_right;
+    std::vector<node_t*>& other = ByLeft ? by_right : by_left;
+    std::size_t n = own.size();
+    if (n == 0)
+      return;
+
+    // Сначала память под все узлы в порядке layout, потом перенос пар.
+    // Соседство в памяти зависит от аллокатора.
+    std::vector<node_t*> fresh(n, nullptr);
+    std::size_t constructed = 0;
+    try {
+      own_tree_t::for_each_built(n, layout, [&](std::size_t i) {
+        fresh[i] = node_traits::allocate(alloc, 1);
+        sink().allocated();
+      });
+      for (; constructed < n; constructed++) {
+        auto* l = static_cast<l_key_t*>(own[constructed]);
+        auto* r = static_cast<r_key_t*>(own[constructed]);
+        // Копируются обе стороны, иначе при исключении одна из них уже
+        // была бы перемещена из старого узла.
+        if constexpr (std::is_nothrow_move_constructible_v<left_t> &&
+                      std::is_nothrow_move_constructible_v<right_t>)
+          node_traits::construct(alloc, fresh[constructed],
+                                 std::move(l->key), std::move(r->key));
+        else
+          node_traits::construct(alloc, fresh[constructed],
+                                 std::as_const(l->key),
+                                 std::as_const(r->key));
+      }
+    } catch (...) {
+      for (std::size_t i = 0; i < n; i++) {
+        if (fresh[i] == nullptr)
+          continue;
+        if (i < constructed)
+          node_traits::destroy(alloc, fresh[i]);
+        node_traits::deallocate(alloc, fresh[i], 1);
+        sink().deallocated(1);
+      }
+      throw;
+    }
+
+    // Старый узел хранит адрес нового в parent своей стороны, пока по
+    // нему переводится порядок другой стороны.
+    for (std::size_t i = 0; i < n; i++) {
+      tree_node_t<own_tag>* old = own[i];
+      old->parent = static_cast<own_key_t*>(fresh[i]);
+    }
+    for (node_t*& cur : other) {
+      tree_node_t<own_tag>* old = cur;
+      tree_node_t<own_tag>* moved = old->parent;
+      cur = static_cast<node_t*>(static_cast<own_key_t*>(moved));
+    }
+    for (node_t* cur : own)
+      free_node(cur);
+    own.swap(fresh);
+
+    left_tree.reset();
+    right_tree.reset();
+    build_trees(by_left, by_right);
+  }
+
+  node_type extract(node_t* n) {
+    unlink_node(n);
+    return node_type(n, alloc);
+  }
+
+  template <typename... Args>
+  node_t* make_node(Args&&... args) {
+    node_t* new_node = node_traits::allocate(alloc, 1);
+    sink().allocated();
+    try {
+      node_traits::construct(alloc, new_node, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(alloc, new_node, 1);
+      sink().deallocated(1);
+      throw;
+    }
+    return new_node;
+  }
+
+  void free_node(node_t* pointer) {
+    node_traits::destroy(alloc, pointer);
+    node_traits::deallocate(alloc, pointer, 1);
+    sink().deallocated(1);
+  }
+
+  void destroy(node_t* pointer) {
+    unlink_node(pointer);
+    free_node(pointer);
+  }
+
+  static left_t const& left_key(node_t const* n) {
+    return static_cast<l_key_t const*>(n)->key;
+  }
+  static right_t const& right_key(node_t const* n) {
+    return static_cast<r_key_t const*>(n)->key;
+  }
+
+  // Подвешивает в пустые деревья узлы, упорядоченные по каждой из сторон.
+  // Не бросает, если корзины хеш-индексов уже выделены prepare_link.
+  void build_trees(std::vector<node_t*> const& by_left,
+                   std::vector<node_t*> const& by_right) {
+    left_tree.build_sorted(by_left.begin(), by_left.end());
+    right_tree.build_sorted(by_right.begin(), by_right.end());
+    n_node = by_left.size();
+  }
+
+  // Стоит ли отцепить k узлов из индекса размера n по одному, а не
+  // перестроить его за O(n).
+  static bool cheaper_to_unlink(std::size_t k, std::size_t n) {
+    return k * std::bit_width(n) < n;
+  }
+
+  // nodes, упорядоченные по правой стороне (для хеш-индекса порядок не
+  // важен).
+  std::vector<node_t*> order_by_right(std::vector<node_t*> nodes) const {
+    if constexpr (r_tree_t::ordered) {
+      std::stable_sort(nodes.begin(), nodes.end(),
+                       [this](node_t const* a, node_t const* b) {
+                         return right_tree.is_less(right_key(a),
+                                                   right_key(b));
+                       });
+    }
+    return nodes;
+  }
+
+  // Узлы дерева в порядке обхода [first, last).
+  template <typename It>
+  static std::vector<node_t*> collect(It first, It last) {
+    std::vector<node_t*> res;
+    for (; first != last; ++first)
+      res.push_back(static_cast<node_t*>(&*first));
+    return res;
+  }
+
+  // Заполняет пустой bimap парами из [first, last). Если sorted, пары уже
+  // упорядочены по left. Остаются те же пары, что и при вставке по очереди:
+  // пара пропускается, если ее left или right уже занят парой, оставленной
+  // раньше. Если left хешируется, пары так и вставляются по очереди.
+  template <typename InputIt>
+  void build_from(InputIt first, InputIt last, bool sorted) {
+    if constexpr (!l_tree_t::ordered) {
+      for (; first != last; ++first)
+        add(first->first, first->second);
+    } else {
+      build_from_sorted_left(first, last, sorted);
+    }
+  }
+
+  template <typename InputIt>
+  void build_from_sorted_left(InputIt first, InputIt last, bool sorted) {
+    std::vector<node_t*> nodes;
+    auto less_left = [this](node_t const* a, node_t const* b) {
+      return left_tree.is_less(left_key(a), left_key(b));
+    };
+    try {
+      for (; first != last; ++first) {
+        nodes.push_back(nullptr);
+        nodes.back() = make_node(first->first, first->second);
+      }
+      std::vector<std::size_t> by_left(nodes.size());
+      for (std::size_t i = 0; i < by_left.size(); i++)
+        by_left[i] = i;
+      if (!sorted)
+        sort_positions(nodes, by_left, less_left);
+      assert(std::is_sorted(
+          by_left.begin(), by_left.end(),
+          [&](std::size_t a, std::size_t b) {
+            return less_left(nodes[a], nodes[b]);
+          }));
+      std::vector<std::size_t> left_group =
+          group_ids(nodes, by_left, less_left);
+
+      if constexpr (r_tree_t::ordered)
+        build_by_sorted_right(nodes, by_left, left_group);
+      else
+        build_by_hashed_right(nodes, by_left, left_group);
+    } catch (...) {
+      right_tree.reset();
+      for (node_t* n : nodes)
+        if (n)
+          free_node(n);
+      throw;
+    }
+  }
+
+  // Упорядочивает номера positions узлов nodes по less.
+  template <typename Less>
+  static void sort_positions(std::vector<node_t*> const& nodes,
+                             std::vector<std::size_t>& positions, Less less) {
+    std::sort(positions.begin(), positions.end(),
+              [&](std::size_t a, std::size_t b) {
+                return less(nodes[a], nodes[b]);
+              });
+  }
+
+  // Номер группы равных ключей для каждого узла nodes; order -- номера
+  // узлов, упорядоченные по less.
+  template <typename Less>
+  static std::vector<std::size_t>
+  group_ids(std::vector<node_t*> const& nodes,
+            std::vector<std::size_t> const& order, Less less) {
+    std::vector<std::size_t> res(nodes.size());
+    std::size_t group = 0;
+    for (std::size_t i = 0; i < order.size(); i++) {
+      if (i != 0 && less(nodes[order[i - 1]], nodes[order[i]]))
+        group++;
+      res[order[i]] = group;
     }
-    return end_left();
+    return res;
+  }
+
+  // Удаляет пару nodes[i] (и обнуляет ее в nodes), если ее группа по left
+  // уже занята; иначе занимает группу.
+  bool take_left(std::vector<node_t*>& nodes, std::size_t i,
+                 std::vector<std::size_t> const& left_group,
+                 std::vector<bool>& taken) {
+    if (taken[left_group[i]]) {
+      free_node(nodes[i]);
+      nodes[i] = nullptr;
+      return false;
+    }
+    taken[left_group[i]] = true;
+    return true;
+  }
+
+  // Узлы nodes в порядке order без удаленных.
+  static std::vector<node_t*>
+  kept_in_order(std::vector<node_t*> const& nodes,
+                std::vector<std::size_t> const& order) {
+    std::vector<node_t*> res;
+    res.reserve(order.size());
+    for (std::size_t i : order)
+      if (nodes[i] != nullptr)
+        res.push_back(nodes[i]);
+    return res;
+  }
+
+  // nodes -- пары в порядке ввода, by_left -- их номера по порядку left,
+  // left_group -- номера групп равных left. Пары перебираются в порядке
+  // ввода, повторы удаляются, остальные подвешиваются в деревья.
+  void build_by_sorted_right(std::vector<node_t*>& nodes,
+                             std::vector<std::size_t> const& by_left,
+                             std::vector<std::size_t> const& left_group)
+    requires r_tree_t::ordered
+  {
+    auto less_right = [this](node_t const* a, node_t const* b) {
+      return right_tree.is_less(right_key(a), right_key(b));
+    };
+    std::vector<std::size_t> by_right(by_left);
+    sort_positions(nodes, by_right, less_right);
+    std::vector<std::size_t> right_group =
+        group_ids(nodes, by_right, less_right);
+    std::vector<bool> left_taken(nodes.size()), right_taken(nodes.size());
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+      if (right_taken[right_group[i]]) {
+        free_node(nodes[i]);
+        nodes[i] = nullptr;
+      } else if (take_left(nodes, i, left_group, left_taken)) {
+        right_taken[right_group[i]] = true;
+      }
+    }
+    build_trees(kept_in_order(nodes, by_left), kept_in_order(nodes, by_right));
+  }
+
+  // То же для хешируемого right: занятость right проверяет сам индекс, в
+  // который пары добавляются в порядке ввода.
+  void build_by_hashed_right(std::vector<node_t*>& nodes,
+                             std::vector<std::size_t> const& by_left,
+                             std::vector<std::size_t> const& left_group)
+    requires(!r_tree_t::ordered)
+  {
+    right_tree.reserve(nodes.size());
+    std::vector<bool> left_taken(nodes.size());
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+      auto r_pos = right_tree.find_with_result(right_key(nodes[i]));
+      if (r_pos.flag == r_tree_t::find_result::THERE_IS) {
+        free_node(nodes[i]);
+        nodes[i] = nullptr;
+      } else if (take_left(nodes, i, left_group, left_taken)) {
+        right_tree.insert_at(r_pos, *nodes[i]);
+      }
+    }
+    std::vector<node_t*> kept = kept_in_order(nodes, by_left);
+    left_tree.build_sorted(kept.begin(), kept.end());
+    n_node = kept.size();
   }
 
 public:
@@ -232,6 +1007,369 @@ public:
     return add(std::move(left), std::move(right));
   }
 
+  // Вставка с подсказками: hint_left и hint_right -- итераторы, перед
+  // которыми, предположительно, окажутся left и right (end для вставки в
+  // конец). Если подсказка верна или ключ больше всех имеющихся, спуска по
+  // дереву не происходит, и дописывание возрастающих ключей стоит
+  // амортизированно O(1). Неверная подсказка только замедляет вставку.
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                       Left const& left, Right const& right) {
+    return add_hinted(hint_left, hint_right, left, right);
+  }
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                       Left const& left, Right&& right) {
+    return add_hinted(hint_left, hint_right, left, std::move(right));
+  }
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                       Left&& left, Right const& right) {
+    return add_hinted(hint_left, hint_right, std::move(left), right);
+  }
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right,
+                       Left&& left, Right&& right) {
+    return add_hinted(hint_left, hint_right, std::move(left),
+                      std::move(right));
+  }
+
+  // Вставка пары, ключи которой конструируются прямо в узле из кортежей
+  // аргументов (как у std::pair). Узел создается до проверки, поэтому при
+  // совпадении ключей он конструируется и тут же уничтожается.
+  template <typename... LeftArgs, typename... RightArgs>
+  left_iterator emplace_pair(std::piecewise_construct_t,
+                             std::tuple<LeftArgs...> left_args,
+                             std::tuple<RightArgs...> right_args) {
+    node_t* new_node =
+        make_node(std::piecewise_construct, std::move(left_args),
+                  std::move(right_args));
+    typename sink_t::probe probe(sink(), intrusive::stats_op::insert);
+    typename l_tree_t::find_result l_pos;
+    typename r_tree_t::find_result r_pos;
+    try {
+      l_pos = left_tree.find_with_result(left_key(new_node));
+      if (l_pos.flag != l_tree_t::find_result::THERE_IS)
+        r_pos = right_tree.find_with_result(right_key(new_node));
+    } catch (...) {
+      free_node(new_node);
+      throw;
+    }
+    if (l_pos.flag == l_tree_t::find_result::THERE_IS ||
+        r_pos.flag == r_tree_t::find_result::THERE_IS) {
+      free_node(new_node);
+      return end_left();
+    }
+    return link_node(new_node, l_pos, r_pos);
+  }
+
+  // Как emplace_pair, но сначала ищет left_probe и right_probe -- сами ключи
+  // или, при прозрачном компараторе, любые сравнимые с ними представления.
+  // Узел создается, только если обоих ключей нет. Сконструированные ключи
+  // должны быть эквивалентны left_probe и right_probe.
+  template <details::lookup_key<Left, CompareLeft> LK,
+            details::lookup_key<Right, CompareRight> RK,
+            typename... LeftArgs, typename... RightArgs>
+  left_iterator try_emplace(LK const& left_probe, RK const& right_probe,
+                            std::piecewise_construct_t,
+                            std::tuple<LeftArgs...> left_args,
+                            std::tuple<RightArgs...> right_args) {
+    return add_probed<true>(left_probe, right_probe, std::piecewise_construct,
+                      std::move(left_args), std::move(right_args));
+  }
+
+  // Вынимают пару из bimap, не освобождая узел. Инвалидируют только
+  // итераторы на эту пару. По ключу, которого нет, возвращают пустой
+  // handle.
+  node_type extract_left(left_iterator it) {
+    return extract(static_cast<node_t*>(&*it.it_tree));
+  }
+  node_type extract_right(right_iterator it) {
+    return extract(static_cast<node_t*>(&*it.it_tree));
+  }
+  node_type extract_left(left_t const& key) {
+    left_iterator it = find_left(key);
+    return it == end_left() ? node_type() : extract_left(it);
+  }
+  node_type extract_right(right_t const& key) {
+    right_iterator it = find_right(key);
+    return it == end_right() ? node_type() : extract_right(it);
+  }
+
+  // Вставляет пару из nh, если ни ее left, ни ее right нет в bimap.
+  // Аллокатор nh должен быть равен аллокатору bimap.
+  insert_return_type insert(node_type&& nh) {
+    if (nh.empty())
+      return {end_left(), false, node_type()};
+    assert(*nh.alloc == alloc);
+    typename sink_t::probe probe(sink(), intrusive::stats_op::insert);
+    auto l_pos = left_tree.find_with_result(left_key(nh.node));
+    if (l_pos.flag == l_tree_t::find_result::THERE_IS)
+      return {left_iterator(left_tree.iterator_at(l_pos.node)), false,
+              std::move(nh)};
+    auto r_pos = right_tree.find_with_result(right_key(nh.node));
+    if (r_pos.flag == r_tree_t::find_result::THERE_IS)
+      return {right_iterator(right_tree.iterator_at(r_pos.node)).flip(),
+              false, std::move(nh)};
+    prepare_link();
+    left_iterator res =
+        link_prepared(std::exchange(nh.node, nullptr), l_pos, r_pos);
+    nh.alloc.reset();
+    return {res, true, node_type()};
+  }
+
+  // Переносит из other все пары, ни один ключ которых не встречается в
+  // *this, без выделения памяти под узлы. Остальные пары остаются в other.
+  // Аллокаторы должны быть равны.
+  void merge(bimap& other) {
+    if (&other == this)
+      return;
+    assert(other.alloc == alloc);
+    // other обходится по возрастанию left, так что следующий ключ, скорее
+    // всего, встанет сразу за только что перенесенным.
+    left_iterator hint = end_left();
+    for (auto it = other.begin_left(); it != other.end_left();) {
+      auto* n = static_cast<node_t*>(&*it.it_tree);
+      ++it;
+      auto l_pos = left_tree.find_with_hint(hint.it_tree, left_key(n));
+      if (l_pos.flag == l_tree_t::find_result::THERE_IS)
+        continue;
+      auto r_pos = right_tree.find_with_result(right_key(n));
+      if (r_pos.flag == r_tree_t::find_result::THERE_IS)
+        continue;
+      prepare_link();
+      other.unlink_node(n);
+      hint = std::next(link_prepared(n, l_pos, r_pos));
+    }
+  }
+  void merge(bimap&& other) {
+    merge(other);
+  }
+
+  // Меняет right пары it на new_right, не пересоздавая узел: left-дерево
+  // не трогается, а в right-дереве узел перевешивается одним спуском,
+  // если new_right не встает между прежними соседями. Итераторы на пару
+  // остаются валидными. Если new_right уже есть у другой пары, ничего не
+  // меняется и возвращается false.
+  bool replace_right(left_iterator it, right_t new_right)
+    requires std::is_nothrow_move_assignable_v<right_t>
+  {
+    return rekey<r_key_t>(right_tree, static_cast<node_t*>(&*it.it_tree),
+                          new_right);
+  }
+  bool replace_left(right_iterator it, left_t new_left)
+    requires std::is_nothrow_move_assignable_v<left_t>
+  {
+    return rekey<l_key_t>(left_tree, static_cast<node_t*>(&*it.it_tree),
+                          new_left);
+  }
+
+  // После вызова key спарен с right; это единственная пара с key и
+  // единственная с right. Вытеснение:
+  // - если key был спарен с другим right, тот right удаляется;
+  // - если right был у пары с другим left, эта пара теряет right: ее
+  //   узел становится парой (key, right), если key не было, иначе пара
+  //   удаляется.
+  // Каждое дерево просматривается один раз, узел создается, только если
+  // не было ни key, ни right. Возвращает итератор на key и true, если key
+  // не было. Как at_left_or_default, но right задается явно.
+  std::pair<left_iterator, bool> insert_or_assign_left(left_t key,
+                                                       right_t right)
+    requires nothrow_rekey
+  {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::insert);
+    auto l_pos = left_tree.find_with_result(key);
+    auto [n, inserted] = assign_pair<true>(l_pos, key, right);
+    return {left_iterator(left_tree.iterator_at(n)), inserted};
+  }
+  std::pair<right_iterator, bool> insert_or_assign_right(right_t key,
+                                                         left_t left)
+    requires nothrow_rekey
+  {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::insert);
+    auto r_pos = right_tree.find_with_result(key);
+    auto [n, inserted] = assign_pair<false>(r_pos, key, left);
+    return {right_iterator(right_tree.iterator_at(n)), inserted};
+  }
+
+  // Переносит в новый bimap все пары с left < key без выделения памяти под
+  // узлы и копирования ключей. Деревья нового bimap строятся по k
+  // перенесенным узлам за линейное время. Если k мало, узлы отцепляются
+  // от деревьев *this по одному, а right'ы нового bimap сортируются;
+  // иначе правое дерево *this за один обход делится на два и оба
+  // строятся заново.
+  bimap split_left(left_t const& key)
+    requires l_tree_t::ordered
+  {
+    bimap res(empty_like, *this);
+    auto bound = left_tree.lower_bound(key);
+    std::vector<node_t*> moved = collect(left_tree.begin(), bound);
+    if (moved.empty())
+      return res;
+    std::size_t n = n_node, k = moved.size();
+    res.prepare_link(k);
+
+    // Левое дерево теряет префикс: удаление минимума в среднем не требует
+    // длинной перебалансировки, так что перестройка выгодна только при
+    // большом k.
+    std::vector<node_t*> rest_left;
+    bool rebuild_left = 2 * k > n;
+    if (rebuild_left)
+      rest_left = collect(bound, left_tree.end());
+
+    std::vector<node_t*> moved_by_right, rest_right;
+    bool rebuild_right = r_tree_t::ordered && !cheaper_to_unlink(k, n);
+    if (rebuild_right) {
+      moved_by_right.reserve(k);
+      rest_right.reserve(n - k);
+      for (auto it = right_tree.begin(); it != right_tree.end(); ++it) {
+        auto* cur = static_cast<node_t*>(&*it);
+        if (left_tree.is_less(left_key(cur), key))
+          moved_by_right.push_back(cur);
+        else
+          rest_right.push_back(cur);
+      }
+    } else {
+      moved_by_right = order_by_right(moved);
+    }
+
+    if (rebuild_left) {
+      left_tree.reset();
+      left_tree.build_sorted(rest_left.begin(), rest_left.end());
+    } else {
+      for (node_t* cur : moved)
+        left_tree.unlink(cur);
+    }
+    if (rebuild_right) {
+      right_tree.reset();
+      right_tree.build_sorted(rest_right.begin(), rest_right.end());
+    } else {
+      for (node_t* cur : moved)
+        right_tree.unlink(cur);
+    }
+    n_node -= k;
+
+    res.build_trees(moved, moved_by_right);
+    return res;
+  }
+
+  // Обратная к split_left операция: забирает все пары other. Все left'ы
+  // other должны быть меньше всех left'ов *this или все больше. Пары
+  // other, чей right уже есть в *this, уничтожаются. Аллокаторы должны
+  // быть равны. Небольшой other вставляется по парам, иначе оба дерева
+  // строятся заново за O(n + m).
+  void join(bimap&& other)
+    requires l_tree_t::ordered
+  {
+    if (&other == this || other.empty())
+      return;
+    assert(other.alloc == alloc);
+    bool other_first =
+        !empty() && left_tree.is_less(other.back_left(), front_left());
+    assert(empty() || other_first ||
+           left_tree.is_less(back_left(), other.front_left()));
+
+    std::size_t n = n_node, m = other.n_node;
+    if (cheaper_to_unlink(m, n + m)) {
+      merge(other);
+      other.clear();
+      return;
+    }
+
+    std::vector<node_t*> by_left, by_right, dropped;
+    by_left.reserve(n + m);
+    by_right.reserve(n + m);
+    bimap& low = other_first ? other : *this;
+    bimap& high = other_first ? *this : other;
+    for (auto it = low.left_tree.begin(); it != low.left_tree.end(); ++it)
+      by_left.push_back(static_cast<node_t*>(&*it));
+    for (auto it = high.left_tree.begin(); it != high.left_tree.end(); ++it)
+      by_left.push_back(static_cast<node_t*>(&*it));
+    merge_by_right(other, by_right, dropped);
+    // Все, что может бросить, делается до первого изменения деревьев.
+    prepare_link(m);
+
+    // Пары из dropped помечаются parent'ом левой связи, указывающим на сам
+    // узел: в дереве так не бывает, а деревья все равно строятся заново,
+    // так что по метке их можно выбросить из by_left без поиска.
+    for (node_t* cur : dropped) {
+      tree_node_t<left_tag>* mark = cur;
+      mark->parent = mark;
+    }
+    std::erase_if(by_left, [](node_t* cur) {
+      tree_node_t<left_tag>* mark = cur;
+      return mark->parent == mark;
+    });
+    left_tree.reset();
+    right_tree.reset();
+    other.left_tree.reset();
+    other.right_tree.reset();
+    other.n_node = 0;
+    for (node_t* cur : dropped)
+      other.free_node(cur);
+    build_trees(by_left, by_right);
+  }
+
+  // Выделяет все узлы заново в порядке layout левого дерева (см.
+  // intrusive::node_layout) и строит оба дерева идеально
+  // сбалансированными. После долгой череды вставок и удалений узлы
+  // разбросаны по куче, и поиск промахивается мимо кэша почти на каждом
+  // уровне. Гарантируется только порядок выделения: узлы берутся у
+  // аллокатора по одному в порядке layout, пока старые еще живы. Лягут ли
+  // они рядом, решает аллокатор: std::allocator может отдать первые узлы
+  // в дыры, оставшиеся после удалений. Ключи
+  // перемещаются, если перемещение обоих не бросает, иначе копируются;
+  // при исключении bimap не меняется. Инвалидирует все итераторы, кроме
+  // end_left() и end_right().
+  void compact_left(
+      intrusive::node_layout layout = intrusive::node_layout::van_emde_boas)
+    requires l_tree_t::ordered
+  {
+    compact_by<true>(layout);
+  }
+  // То же в порядке правого дерева.
+  void compact_right(
+      intrusive::node_layout layout = intrusive::node_layout::van_emde_boas)
+    requires r_tree_t::ordered
+  {
+    compact_by<false>(layout);
+  }
+
+private:
+  // Узлы *this и other в порядке правой стороны. Узлы other с right'ом,
+  // который есть в *this, попадают в dropped.
+  void merge_by_right(bimap& other, std::vector<node_t*>& by_right,
+                      std::vector<node_t*>& dropped) {
+    if constexpr (r_tree_t::ordered) {
+      auto a = right_tree.begin(), b = other.right_tree.begin();
+      while (a != right_tree.end() || b != other.right_tree.end()) {
+        auto* x = a != right_tree.end() ? static_cast<node_t*>(&*a) : nullptr;
+        auto* y = b != other.right_tree.end() ? static_cast<node_t*>(&*b)
+                                               : nullptr;
+        if (y == nullptr ||
+            (x != nullptr && right_tree.is_less(right_key(x), right_key(y)))) {
+          by_right.push_back(x);
+          ++a;
+        } else if (x == nullptr ||
+                   right_tree.is_less(right_key(y), right_key(x))) {
+          by_right.push_back(y);
+          ++b;
+        } else {
+          dropped.push_back(y);
+          ++b;
+        }
+      }
+    } else {
+      for (auto it = right_tree.begin(); it != right_tree.end(); ++it)
+        by_right.push_back(static_cast<node_t*>(&*it));
+      for (auto it = other.right_tree.begin(); it != other.right_tree.end();
+           ++it) {
+        auto* cur = static_cast<node_t*>(&*it);
+        if (right_tree.find(right_key(cur)) == right_tree.end())
+          by_right.push_back(cur);
+        else
+          dropped.push_back(cur);
+      }
+    }
+  }
+
+public:
   // Удаляет элемент и соответствующий ему парный.
   // erase невалидного итератора неопределен.
   // erase(end_left()) и erase(end_right()) неопределены.
@@ -240,16 +1378,26 @@ public:
   left_iterator erase_left(left_iterator it) {
     auto* pointer = static_cast<node_t*>(&(*(it.it_tree)));
     it++;
-    n_node--;
-
-    delete pointer;
+    destroy(pointer);
     return it;
   }
 
   // Аналогично erase, но по ключу, удаляет элемент если он присутствует, иначе
   // не делает ничего Возвращает была ли пара удалена
   bool erase_left(left_t const& left) {
-    left_iterator l_iter = find_left(left);
+    typename sink_t::probe probe(sink(), intrusive::stats_op::erase);
+    left_iterator l_iter(left_tree.find(left));
+    if (l_iter != end_left()) {
+      erase_left(l_iter);
+      return true;
+    }
+    return false;
+  }
+  template <details::transparent_key<Left, CompareLeft> K>
+    requires(!std::is_convertible_v<K const&, left_iterator>)
+  bool erase_left(K const& left) {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::erase);
+    left_iterator l_iter(left_tree.find(left));
     if (l_iter != end_left()) {
       erase_left(l_iter);
       return true;
@@ -260,14 +1408,24 @@ public:
   right_iterator erase_right(right_iterator it) {
     auto* pointer = static_cast<node_t*>(&(*(it.it_tree)));
     it++;
-    n_node--;
-
-    delete pointer;
+    destroy(pointer);
     return it;
   }
 
   bool erase_right(right_t const& right) {
-    right_iterator r_iter = find_right(right);
+    typename sink_t::probe probe(sink(), intrusive::stats_op::erase);
+    right_iterator r_iter(right_tree.find(right));
+    if (r_iter != end_right()) {
+      erase_right(r_iter);
+      return true;
+    }
+    return false;
+  }
+  template <details::transparent_key<Right, CompareRight> K>
+    requires(!std::is_convertible_v<K const&, right_iterator>)
+  bool erase_right(K const& right) {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::erase);
+    right_iterator r_iter(right_tree.find(right));
     if (r_iter != end_right()) {
       erase_right(r_iter);
       return true;
@@ -292,10 +1450,44 @@ public:
 
   // Возвращает итератор по элементу. Если не найден - соответствующий end()
   left_iterator find_left(left_t const& left) const {
-    return left_iterator(left_tree.template find<left_t const&>(left));
+    typename sink_t::probe probe(sink(), intrusive::stats_op::find);
+    return left_iterator(left_tree.find(left));
   }
   right_iterator find_right(right_t const& right) const {
-    return right_iterator(right_tree.template find<right_t const&>(right));
+    typename sink_t::probe probe(sink(), intrusive::stats_op::find);
+    return right_iterator(right_tree.find(right));
+  }
+
+  // Пакетный поиск: out[i] = find_left(keys[i]). Поиски ведутся группами
+  // параллельно с prefetch'ем, что быстрее цикла по find_left, когда дерево
+  // не помещается в кэш. keys и out должны быть одного размера.
+  void find_left_batch(std::span<left_t const> keys,
+                       std::span<left_iterator> out) const {
+    assert(keys.size() == out.size());
+    left_tree.find_batch(keys.data(), keys.size(), [&](std::size_t i, auto it) {
+      out[i] = left_iterator(it);
+    });
+  }
+  void find_right_batch(std::span<right_t const> keys,
+                        std::span<right_iterator> out) const {
+    assert(keys.size() == out.size());
+    right_tree.find_batch(keys.data(), keys.size(),
+                          [&](std::size_t i, auto it) {
+                            out[i] = right_iterator(it);
+                          });
+  }
+
+  // Если компаратор прозрачный, поиск, at, erase и bound'ы принимают любой
+  // сравнимый с ключом тип без создания временного ключа.
+  template <details::transparent_key<Left, CompareLeft> K>
+  left_iterator find_left(K const& left) const {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::find);
+    return left_iterator(left_tree.find(left));
+  }
+  template <details::transparent_key<Right, CompareRight> K>
+  right_iterator find_right(K const& right) const {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::find);
+    return right_iterator(right_tree.find(right));
   }
 
   // Возвращает противоположный элемент по элементу
@@ -314,55 +1506,180 @@ public:
       throw std::out_of_range("cannot find el");
     return *(iter.flip());
   }
+  template <details::transparent_key<Left, CompareLeft> K>
+  right_t const& at_left(K const& key) const {
+    left_iterator iter = find_left(key);
+    if (iter == end_left())
+      throw std::out_of_range("cannot find el");
+    return *(iter.flip());
+  }
+  template <details::transparent_key<Right, CompareRight> K>
+  left_t const& at_right(K const& key) const {
+    right_iterator iter = find_right(key);
+    if (iter == end_right())
+      throw std::out_of_range("cannot find el");
+    return *(iter.flip());
+  }
 
   // Возвращает противоположный элемент по элементу
   // Если элемента не существует, добавляет его в bimap и на противоположную
   // сторону кладет дефолтный элемент, ссылку на который и возвращает
   // Если дефолтный элемент уже лежит в противоположной паре - должен поменять
   // соответствующий ему элемент на запрашиваемый (смотри тесты)
+  // Если ключи можно переписывать в узлах, каждое дерево просматривается
+  // один раз, а узел пары с дефолтным элементом переиспользуется.
   template <typename = std::enable_if<std::is_default_constructible_v<Right>>>
   right_t const& at_left_or_default(left_t const& key) {
-    left_iterator l_iter = find_left(key);
-    if (l_iter == end_left()) {
-      right_iterator r_iter = find_right(right_t());
-      if (r_iter != end_right())
-        erase_right(r_iter);
-      return *(insert(key, right_t()).flip());
-    }
+    if constexpr (nothrow_rekey) {
+      auto l_pos = left_tree.find_with_result(key);
+      if (l_pos.flag == l_tree_t::find_result::THERE_IS)
+        return right_key(static_cast<node_t*>(
+            static_cast<l_key_t*>(l_pos.node)));
+      left_t left = key;
+      right_t right = right_t();
+      return right_key(assign_pair<true>(l_pos, left, right).first);
+    } else {
+      left_iterator l_iter = find_left(key);
+      if (l_iter == end_left()) {
+        right_iterator r_iter = find_right(right_t());
+        if (r_iter != end_right())
+          erase_right(r_iter);
+        return *(insert(key, right_t()).flip());
+      }
 
-    return *(l_iter.flip());
+      return *(l_iter.flip());
+    }
   }
 
   template <typename = std::enable_if<std::is_default_constructible_v<Left>>>
   left_t const& at_right_or_default(right_t const& key) {
-    right_iterator r_iter = find_right(key);
-    if (r_iter == end_right()) {
-      left_iterator l_iter = find_left(left_t());
-      if (l_iter != end_left())
-        erase_left(l_iter);
-      return *(insert(left_t(), key));
-    }
+    if constexpr (nothrow_rekey) {
+      auto r_pos = right_tree.find_with_result(key);
+      if (r_pos.flag == r_tree_t::find_result::THERE_IS)
+        return left_key(static_cast<node_t*>(
+            static_cast<r_key_t*>(r_pos.node)));
+      right_t right = key;
+      left_t left = left_t();
+      return left_key(assign_pair<false>(r_pos, right, left).first);
+    } else {
+      right_iterator r_iter = find_right(key);
+      if (r_iter == end_right()) {
+        left_iterator l_iter = find_left(left_t());
+        if (l_iter != end_left())
+          erase_left(l_iter);
+        return *(insert(left_t(), key));
+      }
 
-    return *(r_iter.flip());
+      return *(r_iter.flip());
+    }
   }
 
   // lower и upper bound'ы по каждой стороне
   // Возвращают итераторы на соответствующие элементы
   // Смотри std::lower_bound, std::upper_bound.
-  left_iterator lower_bound_left(const left_t& key) const {
+  left_iterator lower_bound_left(const left_t& key) const
+    requires l_tree_t::ordered
+  {
     return left_iterator{left_tree.lower_bound(key)};
   }
-  left_iterator upper_bound_left(const left_t& key) const {
+  left_iterator upper_bound_left(const left_t& key) const
+    requires l_tree_t::ordered
+  {
     return left_iterator{left_tree.upper_bound(key)};
   }
 
-  right_iterator lower_bound_right(const right_t& key) const {
+  right_iterator lower_bound_right(const right_t& key) const
+    requires r_tree_t::ordered
+  {
     return right_iterator{right_tree.lower_bound(key)};
   }
-  right_iterator upper_bound_right(const right_t& key) const {
+  right_iterator upper_bound_right(const right_t& key) const
+    requires r_tree_t::ordered
+  {
     return right_iterator{right_tree.upper_bound(key)};
   }
 
+  template <details::transparent_key<Left, CompareLeft> K>
+  left_iterator lower_bound_left(const K& key) const
+    requires l_tree_t::ordered
+  {
+    return left_iterator{left_tree.lower_bound(key)};
+  }
+  template <details::transparent_key<Left, CompareLeft> K>
+  left_iterator upper_bound_left(const K& key) const
+    requires l_tree_t::ordered
+  {
+    return left_iterator{left_tree.upper_bound(key)};
+  }
+
+  template <details::transparent_key<Right, CompareRight> K>
+  right_iterator lower_bound_right(const K& key) const
+    requires r_tree_t::ordered
+  {
+    return right_iterator{right_tree.lower_bound(key)};
+  }
+  template <details::transparent_key<Right, CompareRight> K>
+  right_iterator upper_bound_right(const K& key) const
+    requires r_tree_t::ordered
+  {
+    return right_iterator{right_tree.upper_bound(key)};
+  }
+
+  // Порядковые статистики, доступны только с Augment =
+  // intrusive::order_statistic. Все операции за O(log n).
+
+  // Количество left'ов, меньших key.
+  std::size_t rank_left(left_t const& key) const
+    requires Augment::counted && l_tree_t::ordered
+  {
+    return left_tree.rank(left_tree.lower_bound(key));
+  }
+  std::size_t rank_right(right_t const& key) const
+    requires Augment::counted && r_tree_t::ordered
+  {
+    return right_tree.rank(right_tree.lower_bound(key));
+  }
+
+  // Итератор на k-й по порядку элемент (с нуля), end если k >= size().
+  left_iterator nth_left(std::size_t k) const
+    requires Augment::counted && l_tree_t::ordered
+  {
+    return left_iterator(left_tree.select(k));
+  }
+  right_iterator nth_right(std::size_t k) const
+    requires Augment::counted && r_tree_t::ordered
+  {
+    return right_iterator(right_tree.select(k));
+  }
+
+  // Количество элементов в полуинтервале [from, to).
+  std::size_t count_range_left(left_t const& from, left_t const& to) const
+    requires Augment::counted && l_tree_t::ordered
+  {
+    std::size_t end = rank_left(to), begin = rank_left(from);
+    return end > begin ? end - begin : 0;
+  }
+  std::size_t count_range_right(right_t const& from, right_t const& to) const
+    requires Augment::counted && r_tree_t::ordered
+  {
+    std::size_t end = rank_right(to), begin = rank_right(from);
+    return end > begin ? end - begin : 0;
+  }
+
+  // Аналог std::distance(first, last) за O(log n).
+  std::ptrdiff_t distance(left_iterator first, left_iterator last) const
+    requires Augment::counted && l_tree_t::ordered
+  {
+    return static_cast<std::ptrdiff_t>(left_tree.rank(last.it_tree)) -
+           static_cast<std::ptrdiff_t>(left_tree.rank(first.it_tree));
+  }
+  std::ptrdiff_t distance(right_iterator first, right_iterator last) const
+    requires Augment::counted && r_tree_t::ordered
+  {
+    return static_cast<std::ptrdiff_t>(right_tree.rank(last.it_tree)) -
+           static_cast<std::ptrdiff_t>(right_tree.rank(first.it_tree));
+  }
+
   // Проверка на пустоту
   bool empty() const {
     assert(left_tree.empty() == right_tree.empty());
@@ -376,13 +1693,33 @@ public:
     return n_node;
   }
 
-  template <typename L, typename R, typename cL, typename cR>
-  friend bool operator==(bimap<L, R, cL, cR> const& a,
-                         bimap<L, R, cL, cR> const& b);
+  allocator_type get_allocator() const {
+    return allocator_type(alloc);
+  }
 
-  template <typename L, typename R, typename cL, typename cR>
-  friend bool operator!=(bimap<L, R, cL, cR> const& a,
-                         bimap<L, R, cL, cR> const& b);
+  // Снимок статистики, если Stats включена (например,
+  // intrusive::counting_stats). Не потокобезопасна: с ней пишут даже
+  // const-методы и итераторы. Узлы, освобожденные node_type, не
+  // учитываются. Статистика принадлежит парам, а не объекту: swap и
+  // перемещение переносят ее вместе с ними, и итераторы остаются
+  // валидными.
+  Stats stats() const
+    requires Stats::enabled
+  {
+    return *stats_data.get();
+  }
+
+  void reset_stats()
+    requires Stats::enabled
+  {
+    *stats_data.get() = Stats();
+  }
+
+  template <typename... Params>
+  friend bool operator==(bimap<Params...> const& a, bimap<Params...> const& b);
+
+  template <typename... Params>
+  friend bool operator!=(bimap<Params...> const& a, bimap<Params...> const& b);
 
   bool eq_left(const left_t& a, const left_t& b) const {
     return left_tree.template is_equals<left_t>(a, b);
@@ -394,11 +1731,22 @@ public:
 };
 
 //// операторы сравнения
-template <typename L, typename R, typename cL, typename cR>
-bool operator==(bimap<L, R, cL, cR> const& a, bimap<L, R, cL, cR> const& b) {
+template <typename... Params>
+bool operator==(bimap<Params...> const& a, bimap<Params...> const& b) {
   if (a.size() != b.size())
     return false;
 
+  // Порядок хешируемых left'ов зависит от истории вставок, поэтому пары
+  // сверяются поиском.
+  if constexpr (!bimap<Params...>::l_tree_t::ordered) {
+    for (auto it_a = a.begin_left(); it_a != a.end_left(); it_a++) {
+      auto it_b = b.find_left(*it_a);
+      if (it_b == b.end_left() || !a.eq_right(*it_a.flip(), *it_b.flip()))
+        return false;
+    }
+    return true;
+  }
+
   for (auto it_a = a.begin_left(), it_b = b.begin_left();
        it_a != a.end_left() && it_b != b.end_left(); it_a++, it_b++) {
     if (!a.eq_left(*it_a, *it_b))
@@ -410,7 +1758,7 @@ bool operator==(bimap<L, R, cL, cR> const& a, bimap<L, R, cL, cR> const& b) {
   return true;
 }
 
-template <typename L, typename R, typename cL, typename cR>
-bool operator!=(bimap<L, R, cL, cR> const& a, bimap<L, R, cL, cR> const& b) {
+template <typename... Params>
+bool operator!=(bimap<Params...> const& a, bimap<Params...> const& b) {
   return !(a == b);
 }
@@ -1,24 +1,128 @@
 #pragma once
 
+#include "intrusive_hash.h"
 #include "intrusive_tree.h"
 
+#include <concepts>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 namespace details {
 
 struct left_tag {};
 struct right_tag {};
 
-template <typename Key, typename Tag>
-struct key_t : public intrusive::node<Tag> {
+// Compare сравнивает a с b: как предикат или как трехсторонний компаратор.
+template <typename Compare, typename A, typename B>
+concept compares = std::predicate<Compare const&, A const&, B const&> ||
+                   intrusive::three_way_compare<Compare, A, B>;
+
+// Ключ K можно искать без приведения к типу ключа стороны Key, если
+// компаратор прозрачный (как std::less<>) и умеет сравнивать K с Key в обе
+// стороны.
+template <typename K, typename Key, typename Compare>
+concept transparent_key = requires { typename Compare::is_transparent; } &&
+                          compares<Compare, K, Key> &&
+                          compares<Compare, Key, K>;
+
+// Чем можно искать ключ Key: им самим или, для прозрачных компараторов,
+// любым сравнимым с ним типом.
+template <typename K, typename Key, typename Compare>
+concept lookup_key = std::same_as<std::remove_cvref_t<K>, Key> ||
+                     transparent_key<K, Key, Compare>;
+
+// Представление связей узлов задает аллокатор bimap через node_links,
+// по умолчанию -- обычные указатели.
+template <typename Allocator>
+struct links_of {
+  using type = intrusive::raw_links;
+};
+
+template <typename Allocator>
+  requires requires { typename Allocator::node_links; }
+struct links_of<Allocator> {
+  using type = typename Allocator::node_links;
+};
+
+// Где bimap хранит статистику: при включенной Stats -- отдельный объект в
+// куче, чтобы он переходил вместе с узлами при swap и перемещении, и
+// итераторы, которые пишут в него, оставались валидными.
+template <typename Stats, bool Enabled = Stats::enabled>
+class stats_storage {
+public:
+  Stats* get() const {
+    return nullptr;
+  }
+  void swap(stats_storage&) noexcept {}
+};
+
+template <typename Stats>
+class stats_storage<Stats, true> {
+  std::unique_ptr<Stats> data = std::make_unique<Stats>();
+
+public:
+  Stats* get() const {
+    return data.get();
+  }
+  void swap(stats_storage& other) noexcept {
+    data.swap(other.data);
+  }
+};
+
+template <typename Key, typename Tag, typename Augment = intrusive::no_augment,
+          typename Links = intrusive::raw_links>
+struct key_t : public intrusive::node<Tag, Links>, public Augment::hook {
   Key key;
 
-  explicit key_t(Key&& key) : key(std::move(key)) {}
+  template <typename... Args>
+  explicit key_t(std::in_place_t, Args&&... args)
+      : key(std::forward<Args>(args)...) {}
+
+  template <typename... Args>
+  key_t(std::piecewise_construct_t, std::tuple<Args...>& args)
+      : key(std::make_from_tuple<Key>(std::move(args))) {}
+};
+
+template <typename Left, typename Right,
+          typename Augment = intrusive::no_augment,
+          typename Links = intrusive::raw_links>
+struct node_t : public key_t<Left, left_tag, Augment, Links>,
+                public key_t<Right, right_tag, Augment, Links> {
+  using left_base = key_t<Left, left_tag, Augment, Links>;
+  using right_base = key_t<Right, right_tag, Augment, Links>;
+
+  template <typename L, typename R>
+  node_t(L&& left, R&& right)
+      : left_base(std::in_place, std::forward<L>(left)),
+        right_base(std::in_place, std::forward<R>(right)) {}
+
+  template <typename... LeftArgs, typename... RightArgs>
+  node_t(std::piecewise_construct_t, std::tuple<LeftArgs...> left_args,
+         std::tuple<RightArgs...> right_args)
+      : left_base(std::piecewise_construct, left_args),
+        right_base(std::piecewise_construct, right_args) {}
+};
+
+// Индекс одной стороны bimap: дерево, упорядоченное Compare, или, если
+// вместо компаратора передан intrusive::hashed, хеш-таблица.
+template <typename Key, typename Compare, typename Tag, typename Balance,
+          typename Augment, typename Links, typename Stats>
+struct side_index {
+  using type =
+      intrusive::intrusive_tree<key_t<Key, Tag, Augment, Links>, Compare, Tag,
+                                Balance, Augment, Links, Stats>;
 };
 
-template <typename Left, typename Right>
-struct node_t : public key_t<Left, left_tag>, public key_t<Right, right_tag> {
-  node_t(Left left, Right right)
-      : key_t<Left, left_tag>(std::move(left)), key_t<Right, right_tag>(
-                                                    std::move(right)) {}
+template <typename Key, typename Hash, typename KeyEqual, typename Tag,
+          typename Balance, typename Augment, typename Links, typename Stats>
+struct side_index<Key, intrusive::hashed<Hash, KeyEqual>, Tag, Balance, Augment,
+                  Links, Stats> {
+  using type =
+      intrusive::intrusive_hash_index<key_t<Key, Tag, Augment, Links>,
+                                      intrusive::hashed<Hash, KeyEqual>, Tag,
+                                      Links, Stats>;
 };
 
 } // namespace details
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+namespace details {
+
+// Счетчик читателей, разнесенный по линиям кэша: поток всегда попадает в
+// один и тот же слот, так что читатели разных слотов не делят линию.
+class read_indicator {
+  static constexpr std::size_t slots = 64;
+
+  struct alignas(64) slot {
+    std::atomic<std::size_t> readers{0};
+  };
+
+  std::array<slot, slots> counters;
+
+  static std::size_t my_slot() {
+    static std::atomic<std::size_t> next_thread{0};
+    thread_local std::size_t index = next_thread.fetch_add(1) % slots;
+    return index;
+  }
+
+public:
+  void arrive() {
+    counters[my_slot()].readers.fetch_add(1);
+  }
+
+  void depart() {
+    counters[my_slot()].readers.fetch_sub(1);
+  }
+
+  bool empty() const {
+    for (slot const& s : counters)
+      if (s.readers.load() != 0)
+        return false;
+    return true;
+  }
+};
+
+} // namespace details
+
+// bimap для многих читателей и одного писателя (алгоритм Left-Right).
+// Хранятся два экземпляра bimap: читатели работают с опубликованным,
+// писатель меняет второй, публикует его и, дождавшись ухода читателей
+// старого экземпляра, повторяет изменение в нем. Чтение wait-free: отметка
+// в своем слоте, поиск, снятие отметки. Удаленные узлы освобождаются, когда
+// их уже не видит ни один читатель. Писатели сериализуются мьютексом и
+// ждут читателей; память -- вдвое больше обычного bimap.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Balance = intrusive::avl_balance,
+          typename Allocator = std::allocator<std::pair<Left, Right>>,
+          typename Augment = intrusive::no_augment>
+class concurrent_bimap {
+public:
+  using map_t = bimap<Left, Right, CompareLeft, CompareRight, Balance,
+                      Allocator, Augment>;
+
+private:
+  map_t instances[2];
+  // Экземпляр, с которым работают новые читатели.
+  std::atomic<unsigned> published{0};
+  // Счетчики читателей; писатель переключает новых читателей на другой
+  // счетчик и ждет опустения старого.
+  mutable details::read_indicator indicators[2];
+  std::atomic<unsigned> version{0};
+  std::mutex writer;
+
+  // Применяет f к обоим экземплярам. f должна детерминированно менять
+  // bimap: повторное применение ко второму экземпляру обязано дать тот же
+  // результат. Если f бросает на первом экземпляре, ничего не меняется
+  // (при строгой гарантии f); исключение на втором -- std::terminate.
+  template <typename F>
+  auto update(F f) {
+    std::lock_guard<std::mutex> lock(writer);
+    unsigned cur = published.load();
+    auto res = f(instances[1 - cur]);
+    published.store(1 - cur);
+    wait_for_readers();
+    [&]() noexcept { f(instances[cur]); }();
+    return res;
+  }
+
+  // После возврата ни один читатель не работает с неопубликованным
+  // экземпляром.
+  void wait_for_readers() {
+    unsigned prev = version.load();
+    unsigned next = 1 - prev;
+    while (!indicators[next].empty())
+      std::this_thread::yield();
+    version.store(next);
+    while (!indicators[prev].empty())
+      std::this_thread::yield();
+  }
+
+public:
+  concurrent_bimap() = default;
+
+  concurrent_bimap(concurrent_bimap const&) = delete;
+  concurrent_bimap& operator=(concurrent_bimap const&) = delete;
+
+  // Вызывает f(map_t const&) с опубликованным экземпляром. Ссылки и
+  // итераторы из f нельзя сохранять: после возврата узлы могут быть
+  // освобождены.
+  template <typename F>
+  decltype(auto) read(F&& f) const {
+    unsigned v = version.load();
+    indicators[v].arrive();
+    struct departure {
+      details::read_indicator& indicator;
+      ~departure() {
+        indicator.depart();
+      }
+    } guard{indicators[v]};
+    return std::forward<F>(f)(instances[published.load()]);
+  }
+
+  // Копия парного элемента или nullopt, если ключа нет.
+  std::optional<Right> find_left(Left const& key) const {
+    return read([&](map_t const& m) -> std::optional<Right> {
+      auto it = m.find_left(key);
+      if (it == m.end_left())
+        return std::nullopt;
+      return *it.flip();
+    });
+  }
+  std::optional<Left> find_right(Right const& key) const {
+    return read([&](map_t const& m) -> std::optional<Left> {
+      auto it = m.find_right(key);
+      if (it == m.end_right())
+        return std::nullopt;
+      return *it.flip();
+    });
+  }
+
+  std::size_t size() const {
+    return read([](map_t const& m) { return m.size(); });
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  // Изменения. Возвращают то же, что соответствующие методы bimap.
+  bool insert(Left const& left, Right const& right) {
+    return update(
+        [&](map_t& m) { return m.insert(left, right) != m.end_left(); });
+  }
+
+  bool erase_left(Left const& left) {
+    return update([&](map_t& m) { return m.erase_left(left); });
+  }
+
+  bool erase_right(Right const& right) {
+    return update([&](map_t& m) { return m.erase_right(right); });
+  }
+
+  void clear() {
+    update([](map_t& m) {
+      m.clear();
+      return true;
+    });
+  }
+};
@@ -0,0 +1,406 @@
+#pragma once
+
+#include "bimap.h"
+#include "intrusive_stats.h"
+#include "intrusive_tree.h"
+
+#include <bit>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace details {
+
+// Отсортированные ключи одной стороны в порядке Эйтцингера (BFS-обход
+// идеально сбалансированного дерева): у позиции k (с единицы) дети 2k и
+// 2k + 1, так что первые уровни поиска всегда лежат в кэше. Позиция 0
+// обозначает end. Сравнения и спуски пишутся в Stats, как у дерева.
+template <typename Key, typename Compare, typename Stats = intrusive::no_stats>
+class eytzinger_side : private Compare {
+  using sink_t = intrusive::stats_sink<Stats>;
+
+  // keys[k - 1] -- ключ позиции k, cross[k - 1] -- позиция парного ключа
+  // на другой стороне.
+  std::vector<Key> keys;
+  std::vector<std::size_t> cross;
+  [[no_unique_address]] sink_t stats;
+
+public:
+  explicit eytzinger_side(Compare compare) : Compare(std::move(compare)) {}
+
+  void set_stats(Stats* target) {
+    stats = sink_t(target);
+  }
+
+  std::size_t size() const {
+    return keys.size();
+  }
+
+  Key const& key(std::size_t pos) const {
+    return keys[pos - 1];
+  }
+
+  std::size_t flip(std::size_t pos) const {
+    return pos == 0 ? 0 : cross[pos - 1];
+  }
+
+  // Позиции в порядке возрастания ключей: вызывает f(rank, pos).
+  template <typename F>
+  static void for_each_position(std::size_t n, F f) {
+    std::size_t rank = 0;
+    for (std::size_t pos = first(n); pos != 0; pos = next(n, pos))
+      f(rank++, pos);
+  }
+
+  // sorted[rank] -- ключ ранга rank. Заполняет keys, cross остается
+  // пустым до set_cross.
+  void build(std::vector<Key const*> const& sorted,
+             std::vector<std::size_t>& pos_of_rank) {
+    std::size_t n = sorted.size();
+    std::vector<Key const*> by_pos(n);
+    pos_of_rank.resize(n);
+    for_each_position(n, [&](std::size_t rank, std::size_t pos) {
+      by_pos[pos - 1] = sorted[rank];
+      pos_of_rank[rank] = pos;
+    });
+    keys.reserve(n);
+    for (Key const* k : by_pos)
+      keys.push_back(*k);
+  }
+
+  void set_cross(std::vector<std::size_t> other_pos) {
+    cross = std::move(other_pos);
+  }
+
+  static std::size_t first(std::size_t n) {
+    if (n == 0)
+      return 0;
+    std::size_t pos = 1;
+    while (2 * pos <= n)
+      pos *= 2;
+    return pos;
+  }
+
+  static std::size_t last(std::size_t n) {
+    if (n == 0)
+      return 0;
+    std::size_t pos = 1;
+    while (2 * pos + 1 <= n)
+      pos = 2 * pos + 1;
+    return pos;
+  }
+
+  static std::size_t next(std::size_t n, std::size_t pos) {
+    if (2 * pos + 1 <= n) {
+      pos = 2 * pos + 1;
+      while (2 * pos <= n)
+        pos *= 2;
+      return pos;
+    }
+    // Поднимаемся, пока мы правый ребенок, и еще на один уровень.
+    return pos >> (std::countr_one(pos) + 1);
+  }
+
+  static std::size_t prev(std::size_t n, std::size_t pos) {
+    if (pos == 0)
+      return last(n);
+    if (2 * pos <= n) {
+      pos = 2 * pos;
+      while (2 * pos + 1 <= n)
+        pos = 2 * pos + 1;
+      return pos;
+    }
+    return pos >> (std::countr_zero(pos) + 1);
+  }
+
+  // Компаратор может быть и трехсторонним, как у bimap.
+  template <typename A, typename B>
+  bool less(A const& a, B const& b) const {
+    stats.compared();
+    return intrusive::compare_less(static_cast<Compare const&>(*this), a, b);
+  }
+
+  // Спуск без ветвлений: на каждом уровне позиция выбирается сравнением.
+  // Для арифметических ключей заранее запрашивается линия кэша с
+  // потомками на несколько уровней ниже.
+  template <bool Upper, typename K>
+  std::size_t bound(K const& x) const {
+    std::size_t n = keys.size();
+    Key const* data = keys.data();
+    std::size_t pos = 1;
+    std::size_t depth = 0;
+    while (pos <= n) {
+      depth++;
+      if constexpr (std::is_arithmetic_v<Key>) {
+        constexpr std::size_t per_line = 64 / sizeof(Key);
+        if (pos * per_line <= n)
+          intrusive::prefetch(data + pos * per_line - 1);
+      }
+      bool go_right;
+      if constexpr (Upper)
+        go_right = !less(x, data[pos - 1]);
+      else
+        go_right = less(data[pos - 1], x);
+      pos = 2 * pos + go_right;
+    }
+    stats.descended(depth);
+    // Последний поворот налево и есть ответ.
+    return pos >> (std::countr_one(pos) + 1);
+  }
+
+  template <typename K>
+  std::size_t lower_bound(K const& x) const {
+    return bound<false>(x);
+  }
+
+  template <typename K>
+  std::size_t upper_bound(K const& x) const {
+    return bound<true>(x);
+  }
+
+  template <typename K>
+  std::size_t find(K const& x) const {
+    std::size_t pos = lower_bound(x);
+    if (pos != 0 && less(x, key(pos)))
+      return 0;
+    return pos;
+  }
+};
+
+} // namespace details
+
+// Неизменяемый снимок bimap, оптимизированный для поиска. Каждая сторона
+// хранится массивом в порядке Эйтцингера, пары связаны массивами позиций.
+// Итераторы обходят ключи по возрастанию, как у bimap, и остаются валидными
+// все время жизни снимка.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Stats = intrusive::no_stats>
+class frozen_bimap {
+  using left_side_t = details::eytzinger_side<Left, CompareLeft, Stats>;
+  using right_side_t = details::eytzinger_side<Right, CompareRight, Stats>;
+  using sink_t = intrusive::stats_sink<Stats>;
+
+  template <typename Tag>
+  using side_t = std::conditional_t<std::is_same_v<Tag, details::left_tag>,
+                                    left_side_t, right_side_t>;
+
+  left_side_t left_side;
+  right_side_t right_side;
+  // Как у bimap, в куче: перемещение снимка не отрывает от нее стороны.
+  [[no_unique_address]] details::stats_storage<Stats> stats_data;
+
+  sink_t sink() const {
+    return sink_t(stats_data.get());
+  }
+
+  template <typename Base, typename Pair, typename Tag, typename PairTag>
+  class base_iterator {
+    friend class frozen_bimap;
+    template <typename, typename, typename, typename>
+    friend class base_iterator;
+
+    using Side = side_t<Tag>;
+
+    frozen_bimap const* map = nullptr;
+    std::size_t pos = 0;
+
+    base_iterator(frozen_bimap const* map, std::size_t pos)
+        : map(map), pos(pos) {}
+
+    Side const& side() const {
+      return map->template get_side<Tag>();
+    }
+
+  public:
+    using difference_type = ptrdiff_t;
+    using value_type = Base;
+    using pointer = value_type const*;
+    using reference = value_type const&;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    base_iterator() = default;
+
+    // Разыменование end неопределено.
+    Base const& operator*() const {
+      return side().key(pos);
+    }
+    Base const* operator->() const {
+      return &side().key(pos);
+    }
+
+    base_iterator& operator++() {
+      pos = Side::next(side().size(), pos);
+      return *this;
+    }
+    base_iterator operator++(int) {
+      base_iterator res(*this);
+      ++(*this);
+      return res;
+    }
+
+    // Декремент end дает последний элемент.
+    base_iterator& operator--() {
+      pos = Side::prev(side().size(), pos);
+      return *this;
+    }
+    base_iterator operator--(int) {
+      base_iterator res(*this);
+      --(*this);
+      return res;
+    }
+
+    bool operator==(base_iterator const& b) const {
+      return pos == b.pos;
+    }
+    bool operator!=(base_iterator const& b) const {
+      return pos != b.pos;
+    }
+
+    // Итератор на парный элемент, end переходит в end другой стороны.
+    base_iterator<Pair, Base, PairTag, Tag> flip() const {
+      return {map, side().flip(pos)};
+    }
+  };
+
+  template <typename Tag>
+  side_t<Tag> const& get_side() const {
+    if constexpr (std::is_same_v<Tag, details::left_tag>)
+      return left_side;
+    else
+      return right_side;
+  }
+
+public:
+  using left_iterator =
+      base_iterator<Left, Right, details::left_tag, details::right_tag>;
+  using right_iterator =
+      base_iterator<Right, Left, details::right_tag, details::left_tag>;
+
+  // Снимок содержимого b. Компараторы должны задавать тот же порядок, что
+  // и компараторы b. Статистика снимка своя и начинается с нуля.
+  template <typename Balance, typename Allocator, typename Augment,
+            typename BimapStats>
+  explicit frozen_bimap(bimap<Left, Right, CompareLeft, CompareRight, Balance,
+                              Allocator, Augment, BimapStats> const& b,
+                        CompareLeft compare_left = CompareLeft(),
+                        CompareRight compare_right = CompareRight())
+      : left_side(std::move(compare_left)),
+        right_side(std::move(compare_right)) {
+    left_side.set_stats(stats_data.get());
+    right_side.set_stats(stats_data.get());
+    std::vector<Left const*> lefts;
+    std::vector<Right const*> rights;
+    lefts.reserve(b.size());
+    rights.reserve(b.size());
+    std::unordered_map<Right const*, std::size_t> right_rank(b.size());
+    for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+      right_rank.emplace(&*it, rights.size());
+      rights.push_back(&*it);
+    }
+    // Для каждого left -- ранг парного right.
+    std::vector<std::size_t> pair_rank;
+    pair_rank.reserve(b.size());
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+      lefts.push_back(&*it);
+      pair_rank.push_back(right_rank[&*it.flip()]);
+    }
+
+    std::vector<std::size_t> left_pos, right_pos;
+    left_side.build(lefts, left_pos);
+    right_side.build(rights, right_pos);
+
+    std::vector<std::size_t> left_cross(lefts.size());
+    std::vector<std::size_t> right_cross(lefts.size());
+    for (std::size_t rank = 0; rank < lefts.size(); rank++) {
+      std::size_t l = left_pos[rank], r = right_pos[pair_rank[rank]];
+      left_cross[l - 1] = r;
+      right_cross[r - 1] = l;
+    }
+    left_side.set_cross(std::move(left_cross));
+    right_side.set_cross(std::move(right_cross));
+  }
+
+  std::size_t size() const {
+    return left_side.size();
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  left_iterator begin_left() const {
+    return {this, left_side_t::first(size())};
+  }
+  left_iterator end_left() const {
+    return {this, 0};
+  }
+
+  right_iterator begin_right() const {
+    return {this, right_side_t::first(size())};
+  }
+  right_iterator end_right() const {
+    return {this, 0};
+  }
+
+  // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  left_iterator find_left(Left const& left) const {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::find);
+    return {this, left_side.find(left)};
+  }
+  right_iterator find_right(Right const& right) const {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::find);
+    return {this, right_side.find(right)};
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  Right const& at_left(Left const& key) const {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::find);
+    std::size_t pos = left_side.find(key);
+    if (pos == 0)
+      throw std::out_of_range("cannot find el");
+    return right_side.key(left_side.flip(pos));
+  }
+  Left const& at_right(Right const& key) const {
+    typename sink_t::probe probe(sink(), intrusive::stats_op::find);
+    std::size_t pos = right_side.find(key);
+    if (pos == 0)
+      throw std::out_of_range("cannot find el");
+    return left_side.key(right_side.flip(pos));
+  }
+
+  // Смотри std::lower_bound, std::upper_bound.
+  left_iterator lower_bound_left(Left const& key) const {
+    return {this, left_side.lower_bound(key)};
+  }
+  left_iterator upper_bound_left(Left const& key) const {
+    return {this, left_side.upper_bound(key)};
+  }
+
+  right_iterator lower_bound_right(Right const& key) const {
+    return {this, right_side.lower_bound(key)};
+  }
+  right_iterator upper_bound_right(Right const& key) const {
+    return {this, right_side.upper_bound(key)};
+  }
+
+  // Сравнения и спуски поисков по снимку, если Stats включена. Итераторы
+  // снимка шагов не считают.
+  Stats stats() const
+    requires Stats::enabled
+  {
+    return *stats_data.get();
+  }
+
+  void reset_stats()
+    requires Stats::enabled
+  {
+    *stats_data.get() = Stats();
+  }
+};
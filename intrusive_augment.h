@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+namespace intrusive {
+
+// Политики аугментации узлов дерева. Данные политики (hook) хранятся в типе
+// значения T, который наследуется и от node<Tag, Links>, и от hook.
+
+// Без аугментации: hook пустой, все операции ничего не делают.
+struct no_augment {
+  static constexpr bool counted = false;
+
+  struct hook {};
+
+  template <typename T, typename Node>
+  static void init(Node*) {}
+
+  template <typename T, typename Node>
+  static void update(Node*) {}
+
+  template <typename T, typename Node>
+  static void add_path(Node*, std::ptrdiff_t) {}
+
+  template <typename T, typename Node>
+  static void exchange(Node*, Node*) {}
+};
+
+// Размер поддерева в каждом узле: rank, select и расстояние между
+// итераторами за O(log n).
+struct order_statistic {
+  static constexpr bool counted = true;
+
+  struct hook {
+    std::size_t subtree_size = 1;
+  };
+
+  template <typename T, typename Node>
+  static std::size_t size(Node* n) {
+    return n ? static_cast<T*>(n)->subtree_size : 0;
+  }
+
+  template <typename T, typename Node>
+  static void init(Node* n) {
+    static_cast<T*>(n)->subtree_size = 1;
+  }
+
+  template <typename T, typename Node>
+  static void update(Node* n) {
+    static_cast<T*>(n)->subtree_size =
+        1 + size<T, Node>(n->left) + size<T, Node>(n->right);
+  }
+
+  // Прибавляет delta к размерам от n до корня.
+  template <typename T, typename Node>
+  static void add_path(Node* n, std::ptrdiff_t delta) {
+    for (; n->parent != nullptr; n = n->parent)
+      static_cast<T*>(n)->subtree_size += delta;
+  }
+
+  template <typename T, typename Node>
+  static void exchange(Node* a, Node* b) {
+    std::swap(static_cast<T*>(a)->subtree_size,
+              static_cast<T*>(b)->subtree_size);
+  }
+};
+
+} // namespace intrusive
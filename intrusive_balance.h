@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+
+#include "intrusive_node.h"
+
+namespace intrusive {
+
+// Общие операции над узлами для политик балансировки.
+// Корень дерева -- левый ребенок sentinel'а, у sentinel'а parent == nullptr.
+struct balance_base {
+  template <typename Node>
+  static bool is_root(Node* n) {
+    return n->parent->parent == nullptr;
+  }
+
+  // Поднимает правого ребенка x на место x, возвращает новый корень поддерева.
+  // Update::update пересчитывает аугментацию узлов, сменивших детей.
+  template <typename Update, typename Node>
+  static Node* rotate_left(Node* x) {
+    Node* y = x->right;
+    x->right = y->left;
+    if (y->left)
+      y->left->parent = x;
+    x->relink_parent(y);
+    y->left = x;
+    x->parent = y;
+    Update::update(x);
+    Update::update(y);
+    return y;
+  }
+
+  template <typename Update, typename Node>
+  static Node* rotate_right(Node* x) {
+    Node* y = x->left;
+    x->left = y->right;
+    if (y->right)
+      y->right->parent = x;
+    x->relink_parent(y);
+    y->right = x;
+    x->parent = y;
+    Update::update(x);
+    Update::update(y);
+    return y;
+  }
+
+  // Меняет местами в дереве узел a с двумя детьми и его преемника b.
+  // Данные балансировки остаются привязанными к позиции.
+  template <typename Node>
+  static void exchange_with_successor(Node* a, Node* b) {
+    unsigned char a_balance = a->balance();
+    a->set_balance(b->balance());
+    b->set_balance(a_balance);
+    Node* a_right = a->right;
+    Node* b_parent = b->parent;
+    Node* b_right = b->right;
+
+    a->relink_parent(b);
+    b->left = a->left;
+    b->left->parent = b;
+    if (a_right == b) {
+      b->right = a;
+      a->parent = b;
+    } else {
+      b->right = a_right;
+      a_right->parent = b;
+      b_parent->left = a;
+      a->parent = b_parent;
+    }
+    a->left = nullptr;
+    a->right = b_right;
+    if (b_right)
+      b_right->parent = a;
+  }
+};
+
+// AVL-дерево, balance хранит высоту поддерева (лист имеет высоту 1).
+struct avl_balance : balance_base {
+  template <typename Node>
+  static void init(Node* n) {
+    n->set_balance(1);
+  }
+
+  // Разметка узла идеально сбалансированного дерева, построенного целиком.
+  template <typename Node>
+  static void init_built(Node* n, int height, int, int) {
+    n->set_balance(static_cast<unsigned char>(height));
+  }
+
+  // n только что подвешен листом.
+  template <typename Update, typename Node>
+  static void after_insert(Node* n) {
+    if (!is_root(n))
+      retrace<Update>(static_cast<Node*>(n->parent));
+  }
+
+  // У n не больше одного ребенка. Вырезает n и восстанавливает баланс.
+  template <typename Update, typename Node>
+  static void erase(Node* n) {
+    Node* child = n->left ? n->left : n->right;
+    Node* parent = n->parent;
+    bool root = is_root(n);
+    n->relink_parent(child);
+    if (!root)
+      retrace<Update>(parent);
+  }
+
+private:
+  template <typename Node>
+  static int height(Node* n) {
+    return n ? n->balance() : 0;
+  }
+
+  template <typename Node>
+  static void fix_height(Node* n) {
+    n->set_balance(static_cast<unsigned char>(
+        1 + std::max(height<Node>(n->left), height<Node>(n->right))));
+  }
+
+  template <typename Update, typename Node>
+  static Node* rebalance(Node* n) {
+    int diff = height<Node>(n->left) - height<Node>(n->right);
+    if (diff > 1) {
+      if (height<Node>(n->left->left) <
+          height<Node>(n->left->right)) {
+        Node* l = n->left;
+        rotate_left<Update>(l);
+        fix_height(l);
+      }
+      n = rotate_right<Update>(n);
+      fix_height<Node>(n->right);
+    } else if (diff < -1) {
+      if (height<Node>(n->right->right) <
+          height<Node>(n->right->left)) {
+        Node* r = n->right;
+        rotate_right<Update>(r);
+        fix_height(r);
+      }
+      n = rotate_left<Update>(n);
+      fix_height<Node>(n->left);
+    }
+    fix_height(n);
+    return n;
+  }
+
+  // Поднимается от n к корню, пока высота поддерева меняется.
+  template <typename Update, typename Node>
+  static void retrace(Node* n) {
+    while (n->parent != nullptr) {
+      int old = n->balance();
+      n = rebalance<Update>(n);
+      if (n->balance() == old)
+        break;
+      n = n->parent;
+    }
+  }
+};
+
+// Красно-черное дерево, balance хранит цвет узла.
+struct rb_balance : balance_base {
+  enum : unsigned char { BLACK = 0, RED = 1 };
+
+  template <typename Node>
+  static void init(Node* n) {
+    n->set_balance(RED);
+  }
+
+  // Все листья построенного дерева лежат на двух нижних уровнях, поэтому
+  // достаточно покрасить в красный самый нижний.
+  template <typename Node>
+  static void init_built(Node* n, int, int depth, int max_depth) {
+    n->set_balance(depth == max_depth && depth > 0 ? RED : BLACK);
+  }
+
+  template <typename Update, typename Node>
+  static void after_insert(Node* n) {
+    while (!is_root(n) && is_red<Node>(n->parent)) {
+      Node* p = n->parent;
+      Node* g = p->parent;
+      if (p == g->left) {
+        Node* u = g->right;
+        if (is_red(u)) {
+          p->set_balance(BLACK);
+          u->set_balance(BLACK);
+          g->set_balance(RED);
+          n = g;
+          continue;
+        }
+        if (n == p->right) {
+          rotate_left<Update>(p);
+          p = n;
+        }
+        rotate_right<Update>(g);
+      } else {
+        Node* u = g->left;
+        if (is_red(u)) {
+          p->set_balance(BLACK);
+          u->set_balance(BLACK);
+          g->set_balance(RED);
+          n = g;
+          continue;
+        }
+        if (n == p->left) {
+          rotate_right<Update>(p);
+          p = n;
+        }
+        rotate_left<Update>(g);
+      }
+      p->set_balance(BLACK);
+      g->set_balance(RED);
+      break;
+    }
+    if (is_root(n))
+      n->set_balance(BLACK);
+  }
+
+  template <typename Update, typename Node>
+  static void erase(Node* n) {
+    Node* child = n->left ? n->left : n->right;
+    Node* parent = n->parent;
+    n->relink_parent(child);
+    if (is_red(n))
+      return;
+    if (is_red(child))
+      child->set_balance(BLACK);
+    else
+      erase_fixup<Update>(child, parent);
+  }
+
+private:
+  template <typename Node>
+  static bool is_red(Node* n) {
+    return n && n->balance() == RED;
+  }
+
+  // x -- "дважды черный" узел (возможно nullptr) с родителем parent.
+  template <typename Update, typename Node>
+  static void erase_fixup(Node* x, Node* parent) {
+    while (parent->parent != nullptr && !is_red(x)) {
+      if (x == parent->left) {
+        Node* w = parent->right;
+        if (is_red(w)) {
+          w->set_balance(BLACK);
+          parent->set_balance(RED);
+          rotate_left<Update>(parent);
+          w = parent->right;
+        }
+        if (!is_red<Node>(w->left) && !is_red<Node>(w->right)) {
+          w->set_balance(RED);
+          x = parent;
+          parent = x->parent;
+          continue;
+        }
+        if (!is_red<Node>(w->right)) {
+          w->left->set_balance(BLACK);
+          w->set_balance(RED);
+          rotate_right<Update>(w);
+          w = parent->right;
+        }
+        w->set_balance(parent->balance());
+        parent->set_balance(BLACK);
+        w->right->set_balance(BLACK);
+        rotate_left<Update>(parent);
+      } else {
+        Node* w = parent->left;
+        if (is_red(w)) {
+          w->set_balance(BLACK);
+          parent->set_balance(RED);
+          rotate_right<Update>(parent);
+          w = parent->left;
+        }
+        if (!is_red<Node>(w->left) && !is_red<Node>(w->right)) {
+          w->set_balance(RED);
+          x = parent;
+          parent = x->parent;
+          continue;
+        }
+        if (!is_red<Node>(w->left)) {
+          w->right->set_balance(BLACK);
+          w->set_balance(RED);
+          rotate_left<Update>(w);
+          w = parent->left;
+        }
+        w->set_balance(parent->balance());
+        parent->set_balance(BLACK);
+        w->left->set_balance(BLACK);
+        rotate_right<Update>(parent);
+      }
+      return;
+    }
+    if (x)
+      x->set_balance(BLACK);
+  }
+};
+
+} // namespace intrusive
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+namespace intrusive {
+
+// Общая для всех компактных деревьев арена. Память нарезается из блоков по
+// 1 МБ, выровненных по своему размеру; в начале блока лежит его номер.
+// Объект арены адресуется 30-битным индексом в единицах по 8 байт, поэтому
+// вся арена ограничена 8 ГБ. Освобожденные объекты переиспользуются, но
+// сами блоки системе не возвращаются.
+// Каждый поток режет свой текущий блок и держит свои списки свободных
+// объектов; освобожденный объект попадает в список освободившего потока.
+// Мьютекс берется только при выделении нового блока и при завершении
+// потока, когда его свободные объекты отдаются остальным. Поток, чей кэш
+// уже разрушен (деструктор статического bimap после выхода из main),
+// работает с общими списками под мьютексом.
+class compact_arena {
+public:
+  static constexpr unsigned index_bits = 30;
+  static constexpr std::uint32_t index_mask = (1u << index_bits) - 1;
+  static constexpr std::size_t max_object = 512;
+
+  static void* allocate(std::size_t size) {
+    assert(size <= max_object);
+    std::size_t cls = size_class(size);
+    std::size_t bytes = cls << granularity_shift;
+    if (!cache_alive) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (void* res = pop(orphans[cls]))
+        return res;
+      return carve(shared_cur, shared_last, bytes);
+    }
+    thread_cache& cache = local();
+    if (void* res = pop(cache.free_lists[cls]))
+      return res;
+    if (!fits(cache.cur, cache.last, bytes)) {
+      // Текущий блок исчерпан: сначала объекты завершившихся потоков.
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::size_t c = 0; c != n_classes; ++c)
+        splice(cache.free_lists[c], orphans[c]);
+      if (void* res = pop(cache.free_lists[cls]))
+        return res;
+      add_chunk(cache.cur, cache.last);
+    }
+    return carve(cache.cur, cache.last, bytes);
+  }
+
+  static void deallocate(void* p, std::size_t size) noexcept {
+    auto* block = static_cast<free_block*>(p);
+    std::size_t cls = size_class(size);
+    if (!cache_alive) {
+      std::lock_guard<std::mutex> lock(mutex);
+      push(orphans[cls], block);
+      return;
+    }
+    push(local().free_lists[cls], block);
+  }
+
+  // Индекс объекта, лежащего в арене. Ноль обозначает nullptr.
+  static std::uint32_t encode(void const* p) noexcept {
+    if (p == nullptr)
+      return 0;
+    auto addr = reinterpret_cast<std::uintptr_t>(p);
+    std::uintptr_t base = addr & ~(chunk_size - 1);
+    assert((addr & ((1u << granularity_shift) - 1)) == 0);
+    auto id = *reinterpret_cast<std::uint32_t const*>(base);
+    return id << (chunk_shift - granularity_shift) |
+           static_cast<std::uint32_t>((addr - base) >> granularity_shift);
+  }
+
+  static void* decode(std::uint32_t index) noexcept {
+    return reinterpret_cast<void*>(
+        chunks[index >> (chunk_shift - granularity_shift)] +
+        (std::uintptr_t(index & offset_mask) << granularity_shift));
+  }
+
+private:
+  static constexpr unsigned granularity_shift = 3;
+  static constexpr unsigned chunk_shift = 20;
+  static constexpr std::uintptr_t chunk_size = std::uintptr_t(1)
+                                               << chunk_shift;
+  static constexpr std::uint32_t offset_mask =
+      (1u << (chunk_shift - granularity_shift)) - 1;
+  static constexpr std::size_t max_chunks =
+      std::size_t(1) << (index_bits - (chunk_shift - granularity_shift));
+  static constexpr std::size_t n_classes =
+      (max_object >> granularity_shift) + 1;
+
+  struct free_block {
+    free_block* next;
+  };
+
+  struct thread_cache {
+    char* cur = nullptr;
+    char* last = nullptr;
+    free_block* free_lists[n_classes] = {};
+
+    // Свободные объекты завершившегося потока достаются следующему потоку,
+    // которому не хватит своего блока. Остаток блока теряется.
+    ~thread_cache() {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::size_t cls = 0; cls != n_classes; ++cls)
+        splice(orphans[cls], free_lists[cls]);
+      cache_alive = false;
+    }
+  };
+
+  // Блок с номером 0 не выделяется, chunks[0] == 0, так что decode(0)
+  // возвращает nullptr без ветвления. Блок регистрируется до того, как
+  // ссылки на его объекты попадут к другим потокам.
+  static inline std::uintptr_t chunks[max_chunks] = {};
+  static inline std::uint32_t n_chunks = 1;
+  static inline free_block* orphans[n_classes] = {};
+  // Блок, из которого режут потоки без кэша.
+  static inline char* shared_cur = nullptr;
+  static inline char* shared_last = nullptr;
+  static inline std::mutex mutex;
+  // Сбрасывается деструктором кэша потока и, в отличие от самого кэша,
+  // доступен до конца потока.
+  static inline thread_local bool cache_alive = true;
+
+  static thread_cache& local() noexcept {
+    static thread_local thread_cache cache;
+    return cache;
+  }
+
+  static std::size_t size_class(std::size_t size) {
+    if (size < sizeof(free_block))
+      size = sizeof(free_block);
+    return (size + (1u << granularity_shift) - 1) >> granularity_shift;
+  }
+
+  // Дописывает список from в начало to.
+  static void splice(free_block*& to, free_block*& from) noexcept {
+    if (from == nullptr)
+      return;
+    free_block* tail = from;
+    while (tail->next != nullptr)
+      tail = tail->next;
+    tail->next = to;
+    to = from;
+    from = nullptr;
+  }
+
+  static void* pop(free_block*& head) noexcept {
+    free_block* res = head;
+    if (res != nullptr)
+      head = res->next;
+    return res;
+  }
+
+  static void push(free_block*& head, free_block* block) noexcept {
+    block->next = head;
+    head = block;
+  }
+
+  static bool fits(char* cur, char* last, std::size_t bytes) noexcept {
+    return cur != nullptr && bytes <= static_cast<std::size_t>(last - cur);
+  }
+
+  // Отрезает bytes от блока [cur, last), при нехватке места начиная новый.
+  // Вызывающий держит mutex, если блок не принадлежит одному потоку.
+  static void* carve(char*& cur, char*& last, std::size_t bytes) {
+    if (!fits(cur, last, bytes))
+      add_chunk(cur, last);
+    void* res = cur;
+    cur += bytes;
+    return res;
+  }
+
+  // Выделяет и регистрирует новый блок. Вызывается под mutex.
+  static void add_chunk(char*& cur, char*& last) {
+    if (n_chunks == max_chunks)
+      throw std::bad_alloc();
+    auto* chunk = static_cast<char*>(
+        ::operator new(chunk_size, std::align_val_t(chunk_size)));
+    *reinterpret_cast<std::uint32_t*>(chunk) = n_chunks;
+    chunks[n_chunks++] = reinterpret_cast<std::uintptr_t>(chunk);
+    cur = chunk + (1u << granularity_shift);
+    last = chunk + chunk_size;
+  }
+};
+
+// 32-битная ссылка на узел в compact_arena. Два старших бита не относятся к
+// адресу: в них хранится часть данных балансировки узла-владельца, поэтому
+// присваивание ссылок переносит только индекс.
+template <typename Node>
+class compact_link {
+  static constexpr unsigned tag_shift = compact_arena::index_bits;
+  static constexpr std::uint32_t index_mask = compact_arena::index_mask;
+
+  std::uint32_t bits = 0;
+
+public:
+  compact_link() = default;
+  explicit compact_link(Node* p) : bits(compact_arena::encode(p)) {}
+  compact_link(compact_link const& other) : bits(other.bits & index_mask) {}
+
+  compact_link& operator=(compact_link const& other) {
+    bits = (bits & ~index_mask) | (other.bits & index_mask);
+    return *this;
+  }
+
+  compact_link& operator=(Node* p) {
+    bits = (bits & ~index_mask) | compact_arena::encode(p);
+    return *this;
+  }
+
+  operator Node*() const {
+    return static_cast<Node*>(compact_arena::decode(bits & index_mask));
+  }
+
+  Node* operator->() const {
+    return *this;
+  }
+
+  unsigned tag() const {
+    return bits >> tag_shift;
+  }
+
+  void set_tag(unsigned tag) {
+    bits = (bits & index_mask) | (std::uint32_t(tag) << tag_shift);
+  }
+};
+
+// Связи узла -- 32-битные индексы в compact_arena. Данные балансировки
+// (до 6 бит) разложены по старшим битам трех связей, так что узел занимает
+// 12 байт вместо 32. Узлы и sentinel'ы обязаны лежать в арене, поэтому
+// создание sentinel'а может бросить bad_alloc.
+struct compact_links {
+  template <typename Node>
+  using link = compact_link<Node>;
+
+  struct balance_t {};
+
+  static constexpr std::size_t align = 8;
+  static constexpr bool nothrow_sentinel = false;
+
+  template <typename Node>
+  static unsigned char get_balance(Node const& n) {
+    return static_cast<unsigned char>(n.parent.tag() | n.left.tag() << 2 |
+                                      n.right.tag() << 4);
+  }
+
+  template <typename Node>
+  static void set_balance(Node& n, unsigned char balance) {
+    assert(balance < 64);
+    n.parent.set_tag(balance & 3);
+    n.left.set_tag((balance >> 2) & 3);
+    n.right.set_tag((balance >> 4) & 3);
+  }
+
+  template <typename Node>
+  class sentinel {
+    Node* node;
+
+  public:
+    sentinel() : node(new (compact_arena::allocate(sizeof(Node))) Node) {}
+
+    sentinel(sentinel const&) = delete;
+    sentinel& operator=(sentinel const&) = delete;
+
+    ~sentinel() {
+      node->~Node();
+      compact_arena::deallocate(node, sizeof(Node));
+    }
+
+    Node* get() const {
+      return node;
+    }
+  };
+};
+
+} // namespace intrusive
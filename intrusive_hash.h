@@ -0,0 +1,449 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "intrusive_node.h"
+#include "intrusive_stats.h"
+#include "intrusive_tree.h"
+
+namespace intrusive {
+
+// Подставляется вместо компаратора стороны bimap: сторона индексируется
+// хеш-таблицей, поиск по ключу -- O(1) в среднем, а порядка нет.
+template <typename Hash, typename KeyEqual = std::equal_to<>>
+struct hashed {
+  [[no_unique_address]] Hash hasher;
+  [[no_unique_address]] KeyEqual key_equal;
+
+  hashed(Hash hash = Hash(), KeyEqual equal = KeyEqual())
+      : hasher(std::move(hash)), key_equal(std::move(equal)) {}
+
+  template <typename K>
+  std::size_t hash(K const& key) const {
+    return hasher(key);
+  }
+
+  template <typename A, typename B>
+  bool equal(A const& a, B const& b) const {
+    return key_equal(a, b);
+  }
+};
+
+// Интрузивная хеш-таблица с цепочками с тем же интерфейсом, что и у
+// intrusive_tree, кроме упорядоченных операций.
+// Связи узла: right -- следующий в цепочке корзины, left и parent --
+// следующий и предыдущий в списке всех узлов в порядке вставки, по которому
+// идут итераторы. У sentinel'а left -- последний узел, parent == nullptr,
+// right свободен для пользователя, как и в intrusive_tree.
+// Hash и KeyEqual не должны бросать исключений.
+template <typename T, typename Hashed, typename Tag = default_tag,
+          typename Links = raw_links, typename Stats = no_stats>
+class intrusive_hash_index : public Hashed {
+  using node_t = node<Tag, Links>;
+  using sink_t = stats_sink<Stats>;
+  static_assert(std::is_convertible_v<T*, node_t*>, "invalid value type");
+
+  typename Links::template sentinel<node_t> sentinel;
+  node_t* head = sentinel.get();
+  std::vector<node_t*> buckets;
+  // buckets.size() == 2^(64 - shift).
+  unsigned shift = 64;
+  std::size_t count = 0;
+  [[no_unique_address]] sink_t stats;
+
+public:
+  static constexpr bool ordered = false;
+
+  explicit intrusive_hash_index(Hashed hashed = Hashed{})
+      : Hashed(std::move(hashed)) {}
+
+  intrusive_hash_index(intrusive_hash_index const& other) = delete;
+  intrusive_hash_index(intrusive_hash_index&& other) = delete;
+
+  // Как у intrusive_tree: статистика принадлежит владельцу индекса.
+  void set_stats(Stats* target) {
+    stats = sink_t(target);
+  }
+
+  void swap(intrusive_hash_index& other) {
+    std::swap(static_cast<Hashed&>(*this), static_cast<Hashed&>(other));
+    node_t* tail = get_sentinel()->left;
+    get_sentinel()->left = other.get_sentinel()->left;
+    other.get_sentinel()->left = tail;
+    std::swap(head, other.head);
+    std::swap(buckets, other.buckets);
+    std::swap(shift, other.shift);
+    std::swap(count, other.count);
+    repair_list_ends();
+    other.repair_list_ends();
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+
+  node_t* get_sentinel() const {
+    return sentinel.get();
+  }
+
+  class iterator {
+    node_t* cur = nullptr;
+    [[no_unique_address]] sink_t stats;
+
+    friend class intrusive_hash_index;
+
+  public:
+    using difference_type = ptrdiff_t;
+    using value_type = T;
+    using pointer = value_type*;
+    using reference = value_type&;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    iterator() = default;
+    iterator(node_t* cur) : cur(cur) {}
+    iterator(node_t* cur, sink_t stats) : cur(cur), stats(stats) {}
+
+    bool operator==(iterator const& other) const {
+      return cur == other.cur;
+    }
+    bool operator!=(iterator const& other) const {
+      return cur != other.cur;
+    }
+
+    bool is_end() const {
+      return cur->parent == nullptr;
+    }
+
+    node_t* get_node() const {
+      return cur;
+    }
+
+    sink_t get_stats() const {
+      return stats;
+    }
+
+    reference operator*() const {
+      return *(static_cast<T*>(cur));
+    }
+    pointer operator->() const {
+      return static_cast<T*>(cur);
+    }
+
+    iterator& operator++() {
+      stats.stepped();
+      cur = cur->left;
+      return *this;
+    }
+    // Декремент end дает последний узел.
+    iterator& operator--() {
+      stats.stepped();
+      cur = cur->parent == nullptr ? cur->left : cur->parent;
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator res(*this);
+      ++(*this);
+      return res;
+    }
+    iterator operator--(int) {
+      iterator res(*this);
+      --(*this);
+      return res;
+    }
+  };
+
+  iterator begin() const {
+    return iterator_at(head);
+  }
+
+  iterator end() const {
+    return iterator_at(get_sentinel());
+  }
+
+  // Последний вставленный узел, end() для пустого индекса.
+  iterator last() const {
+    return empty() ? end() : iterator_at(get_sentinel()->left);
+  }
+
+  iterator iterator_at(node_t* n) const {
+    return iterator(n, stats);
+  }
+
+  static const T& make_r(node_t& p) {
+    return static_cast<T&>(p);
+  }
+
+  template <typename key>
+  bool is_equals(const key& a, const key& b) const {
+    return equal(a, b);
+  }
+
+  // Равенство для проверок в assert: не пишет статистику.
+  template <typename A, typename B>
+  bool matches(A const& a, B const& b) const {
+    return Hashed::equal(a, b);
+  }
+
+  // Результат поиска: найденный узел или хеш ключа для вставки.
+  struct find_result {
+    enum { THERE_IS, ADD_RIGHT, ADD_LEFT } flag;
+    node_t* node;
+    std::size_t hash;
+  };
+
+  template <class fT>
+  find_result find_with_result(fT&& data) const {
+    std::size_t h = Hashed::hash(data);
+    std::size_t length = 0;
+    if (count != 0) {
+      for (node_t* cur = buckets[bucket(h)]; cur != nullptr;
+           cur = cur->right) {
+        length++;
+        if (equal(make_r(*cur).key, data)) {
+          stats.descended(length);
+          return {find_result::THERE_IS, cur, h};
+        }
+      }
+    }
+    stats.descended(length);
+    return {find_result::ADD_LEFT, nullptr, h};
+  }
+
+  // Подсказки порядка не имеют смысла без порядка.
+  template <class fT>
+  find_result find_with_hint(iterator, fT&& data) const {
+    return find_with_result(data);
+  }
+
+  template <class fT>
+  iterator find(fT&& x) const {
+    find_result res = find_with_result(x);
+    if (res.flag == find_result::THERE_IS)
+      return iterator_at(res.node);
+    return end();
+  }
+
+  // Как intrusive_tree::find_batch: сначала для группы ключей
+  // запрашиваются корзины, потом разбираются цепочки.
+  static constexpr std::size_t batch_group = 16;
+
+  template <class fT, typename Out>
+  void find_batch(fT const* keys, std::size_t n, Out out) const {
+    std::size_t hashes[batch_group];
+    for (std::size_t base = 0; base < n; base += batch_group) {
+      std::size_t m = std::min(batch_group, n - base);
+      for (std::size_t i = 0; i < m; i++) {
+        hashes[i] = Hashed::hash(keys[base + i]);
+        if (count != 0)
+          prefetch(&buckets[bucket(hashes[i])]);
+      }
+      for (std::size_t i = 0; i < m; i++) {
+        iterator res = end();
+        std::size_t length = 0;
+        if (count != 0) {
+          for (node_t* cur = buckets[bucket(hashes[i])]; cur != nullptr;
+               cur = cur->right) {
+            length++;
+            if (equal(make_r(*cur).key, keys[base + i])) {
+              res = iterator_at(cur);
+              break;
+            }
+          }
+        }
+        stats.descended(length);
+        out(base + i, res);
+      }
+    }
+  }
+
+  iterator insert(node_t& data) {
+    find_result res = find_with_result(make_r(data).key);
+    if (res.flag == find_result::THERE_IS)
+      return end();
+    return insert_at(res, data);
+  }
+
+  // Готовит корзины под n узлов, после чего insert_at до n узлов не
+  // выделяет память и не бросает исключений.
+  void reserve(std::size_t n) {
+    if (n <= buckets.size())
+      return;
+    std::size_t size = std::max<std::size_t>(16, buckets.size());
+    while (size < n)
+      size *= 2;
+    rehash(size);
+  }
+
+  // Добавляет data по результату find_with_result. Между поиском и
+  // вставкой индекс не должен меняться.
+  iterator insert_at(find_result res, node_t& data) {
+    reserve(count + 1);
+    link(&data, res.hash);
+    stats.relinked();
+    return iterator_at(&data);
+  }
+
+  // Как intrusive_tree::relocate: n переходит в корзину нового ключа,
+  // хеш которого посчитан find_with_result, и в конец списка. Не выделяет
+  // память и не бросает, если не бросает rekey.
+  template <typename Rekey>
+  void relocate(node_t* n, find_result pos, Rekey rekey) {
+    unlink(n);
+    rekey();
+    insert_at(pos, *n);
+  }
+
+  find_result unlink_to_slot(node_t* n) {
+    std::size_t h = Hashed::hash(make_r(*n).key);
+    unlink(n);
+    return {find_result::ADD_LEFT, nullptr, h};
+  }
+
+  iterator remove(iterator it) {
+    iterator it_next = iterator_at(it.cur->left);
+    unlink(it.cur);
+    return it_next;
+  }
+
+  template <class rT>
+    requires(!std::is_convertible_v<rT, iterator>)
+  iterator remove(rT&& data) {
+    find_result res = find_with_result(data);
+    if (res.flag != find_result::THERE_IS)
+      return end();
+    return remove(iterator_at(res.node));
+  }
+
+  // Добавляет узлы [first, last) без проверки на повторы, сохраняя их
+  // порядок для итерации. Индекс должен быть пустым.
+  template <typename It>
+  void build_sorted(It first, It last) {
+    reserve(last - first);
+    for (; first != last; ++first) {
+      node_t* cur = *first;
+      link(cur, Hashed::hash(make_r(*cur).key));
+    }
+  }
+
+  // Забывает все узлы, не трогая их связи.
+  void reset() {
+    std::fill(buckets.begin(), buckets.end(), nullptr);
+    head = get_sentinel();
+    get_sentinel()->left = nullptr;
+    count = 0;
+  }
+
+  // Отдает все узлы в dispose и оставляет индекс пустым.
+  template <typename Dispose>
+  void clear_and_dispose(Dispose dispose) {
+    node_t* cur = head;
+    while (cur != get_sentinel()) {
+      node_t* next = cur->left;
+      dispose(static_cast<T*>(cur));
+      cur = next;
+    }
+    reset();
+  }
+
+  void unlink(node_t* n) {
+    std::size_t b = bucket(Hashed::hash(make_r(*n).key));
+    node_t* prev_in_bucket = nullptr;
+    for (node_t* cur = buckets[b]; cur != n; cur = cur->right)
+      prev_in_bucket = cur;
+    if (prev_in_bucket)
+      prev_in_bucket->right = n->right;
+    else
+      buckets[b] = n->right;
+
+    node_t* s = get_sentinel();
+    node_t* prev = n->parent;
+    node_t* next = n->left;
+    if (prev == s)
+      head = next;
+    else
+      prev->left = next;
+    if (next == s)
+      s->left = prev == s ? nullptr : prev;
+    else
+      next->parent = prev;
+    count--;
+    n->parent = n->left = n->right = nullptr;
+    stats.relinked();
+  }
+
+private:
+  template <typename A, typename B>
+  bool equal(A const& a, B const& b) const {
+    stats.compared();
+    return Hashed::equal(a, b);
+  }
+
+  // Старшие биты произведения на 2^64 / phi: младшие биты std::hash часто
+  // совпадают у соседних ключей.
+  std::size_t bucket(std::size_t h) const {
+    return static_cast<std::size_t>(
+        (static_cast<std::uint64_t>(h) * 0x9E3779B97F4A7C15ull) >> shift);
+  }
+
+  // Подвешивает n в корзину и в конец списка.
+  void link(node_t* n, std::size_t h) {
+    std::size_t b = bucket(h);
+    n->right = buckets[b];
+    buckets[b] = n;
+
+    node_t* s = get_sentinel();
+    node_t* tail = empty() ? s : static_cast<node_t*>(s->left);
+    n->parent = tail;
+    n->left = s;
+    if (tail == s)
+      head = n;
+    else
+      tail->left = n;
+    s->left = n;
+    count++;
+  }
+
+  // size -- степень двойки.
+  void rehash(std::size_t size) {
+    std::vector<node_t*> old(size, nullptr);
+    old.swap(buckets);
+    shift = 64;
+    for (std::size_t s = size; s > 1; s /= 2)
+      shift--;
+    for (node_t* chain : old) {
+      while (chain != nullptr) {
+        node_t* next = chain->right;
+        std::size_t b = bucket(Hashed::hash(make_r(*chain).key));
+        chain->right = buckets[b];
+        buckets[b] = chain;
+        chain = next;
+      }
+    }
+  }
+
+  // После swap крайние узлы списка должны ссылаться на свой sentinel.
+  void repair_list_ends() {
+    node_t* s = get_sentinel();
+    if (empty()) {
+      head = s;
+      s->left = nullptr;
+      return;
+    }
+    head->parent = s;
+    static_cast<node_t*>(s->left)->left = s;
+  }
+};
+
+} // namespace intrusive
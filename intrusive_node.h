@@ -1,19 +1,65 @@
 #pragma once
 
+#include <cstddef>
+#include <utility>
+
 namespace intrusive {
 
 struct default_tag;
 
-template <typename Tag = default_tag>
-struct node {
-  node* parent = nullptr;
-  node* left = nullptr;
-  node* right = nullptr;
+// Представление связей узла по умолчанию: обычные указатели, служебные
+// данные балансировки хранятся отдельным байтом.
+struct raw_links {
+  template <typename Node>
+  using link = Node*;
+
+  using balance_t = unsigned char;
+
+  static constexpr std::size_t align = alignof(void*);
+  static constexpr bool nothrow_sentinel = true;
+
+  template <typename Node>
+  static unsigned char get_balance(Node const& n) {
+    return n.balance_data;
+  }
+
+  template <typename Node>
+  static void set_balance(Node& n, unsigned char balance) {
+    n.balance_data = balance;
+  }
+
+  // Sentinel дерева хранится прямо в дереве.
+  template <typename Node>
+  class sentinel {
+    Node node;
+
+  public:
+    Node* get() const {
+      return const_cast<Node*>(&node);
+    }
+  };
+};
+
+template <typename Tag = default_tag, typename Links = raw_links>
+struct alignas(Links::align) node {
+  using link_t = typename Links::template link<node>;
+
+  link_t parent{};
+  link_t left{};
+  link_t right{};
+  // Служебные данные балансировки: высота для avl_balance, цвет для
+  // rb_balance. Смысл задает политика дерева, где они лежат -- Links.
+  [[no_unique_address]] typename Links::balance_t balance_data{};
 
   node() = default;
   explicit node(node* parent) : parent(parent) {}
-  ~node() {
-    unlink();
+
+  unsigned char balance() const {
+    return Links::get_balance(*this);
+  }
+
+  void set_balance(unsigned char balance) {
+    Links::set_balance(*this, balance);
   }
 
   bool is_right() {
@@ -36,25 +82,6 @@ struct node {
       right->parent = this;
   }
 
-  void unlink() {
-    if (parent) {
-      if (right != nullptr && left == nullptr) {
-        relink_parent(right);
-        right = nullptr;
-      } else if (right == nullptr && left != nullptr) {
-        relink_parent(left);
-        left = nullptr;
-      } else if (right != nullptr && left != nullptr) {
-        node* next = min_node(right);
-        next->unlink();
-        this->swap(*next);
-      } else {
-        relink_parent(nullptr);
-      }
-      parent = nullptr;
-    }
-  }
-
   static node* min_node(node* cur) {
     while (cur->left)
       cur = cur->left;
@@ -86,6 +113,41 @@ struct node {
     return prev;
   }
 
+  // Как next_node и prev_node, но вызывают hop() на каждой пройденной
+  // связи. Отдельные функции, чтобы не мешать встраиванию обычного обхода.
+  template <typename Hop>
+  static node* next_node(node* cur, Hop hop) {
+    hop();
+    if (cur->right) {
+      for (cur = cur->right; cur->left; cur = cur->left)
+        hop();
+      return cur;
+    }
+    node* next = cur->parent;
+    while (next->parent != nullptr && cur == next->right) {
+      cur = next;
+      next = next->parent;
+      hop();
+    }
+    return next;
+  }
+  template <typename Hop>
+  static node* prev_node(node* cur, Hop hop) {
+    hop();
+    if (cur->left) {
+      for (cur = cur->left; cur->right; cur = cur->right)
+        hop();
+      return cur;
+    }
+    node* prev = cur->parent;
+    while (prev->parent != nullptr && cur == prev->left) {
+      cur = prev;
+      prev = prev->parent;
+      hop();
+    }
+    return prev;
+  }
+
   node* next() {
     return next_node(this);
   }
@@ -104,6 +166,9 @@ struct node {
 
     std::swap(left, other.left);
     std::swap(right, other.right);
+    unsigned char tmp = balance();
+    set_balance(other.balance());
+    other.set_balance(tmp);
     repair_childs();
     other.repair_childs();
   }
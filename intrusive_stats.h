@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace intrusive {
+
+// Политики статистики деревьев и bimap. Политика с enabled == false
+// ничего не хранит, и все хуки компилируются в пустоту. Включенная
+// политика -- тип со счетчиками counting_stats (или наследник), в
+// который дерево пишет через stats_sink.
+
+// Без статистики.
+struct no_stats {
+  static constexpr bool enabled = false;
+};
+
+// Гистограмма по степеням двойки: counts[i] -- сколько раз встретилось
+// значение v с std::bit_width(v) == i, то есть 0 для i == 0 и
+// [2^(i-1), 2^i) для остальных.
+struct log2_histogram {
+  std::array<std::uint64_t, 65> counts{};
+
+  void add(std::uint64_t v) {
+    counts[std::bit_width(v)]++;
+  }
+
+  std::uint64_t total() const {
+    std::uint64_t res = 0;
+    for (std::uint64_t c : counts)
+      res += c;
+    return res;
+  }
+};
+
+// Операции bimap, для которых ведутся гистограммы сравнений.
+enum class stats_op { find, insert, erase };
+
+// Счетчики и гистограммы. Сравнения и спуски считаются по обеим сторонам
+// вместе.
+struct counting_stats {
+  static constexpr bool enabled = true;
+
+  // Вызовы компаратора или KeyEqual.
+  std::uint64_t comparisons = 0;
+  // Подвешивания и вырезания узлов, включая обмен с преемником при
+  // удалении. Повороты балансировки не считаются.
+  std::uint64_t relinks = 0;
+  // Связи, пройденные итераторами при инкрементах и декрементах.
+  std::uint64_t iterator_steps = 0;
+  std::uint64_t allocations = 0;
+  std::uint64_t deallocations = 0;
+  // Число узлов, пройденных одним спуском от корня (или по цепочке
+  // корзины хеш-индекса).
+  log2_histogram descent_length;
+  // Сравнения за одну операцию bimap.
+  log2_histogram find_comparisons;
+  log2_histogram insert_comparisons;
+  log2_histogram erase_comparisons;
+
+  log2_histogram& comparisons_of(stats_op op) {
+    switch (op) {
+    case stats_op::find:
+      return find_comparisons;
+    case stats_op::insert:
+      return insert_comparisons;
+    default:
+      return erase_comparisons;
+    }
+  }
+};
+
+// Куда пишет статистику дерево или итератор: указатель на Stats владельца
+// или, если статистика выключена, пустой объект. Пока указатель не
+// задан, хуки ничего не делают.
+template <typename Stats, bool Enabled = Stats::enabled>
+class stats_sink {
+public:
+  // Считает сравнения одной операции от создания до разрушения.
+  struct probe {
+    explicit probe(stats_sink, stats_op) {}
+  };
+
+  stats_sink() = default;
+  explicit stats_sink(Stats*) {}
+
+  void compared() const {}
+  void descended(std::size_t) const {}
+  void relinked() const {}
+  void stepped() const {}
+  void allocated() const {}
+  void deallocated(std::size_t) const {}
+};
+
+template <typename Stats>
+class stats_sink<Stats, true> {
+  Stats* target = nullptr;
+
+public:
+  class probe {
+    Stats* target;
+    stats_op op;
+    std::uint64_t start;
+
+  public:
+    probe(stats_sink sink, stats_op op)
+        : target(sink.target), op(op),
+          start(target ? target->comparisons : 0) {}
+
+    probe(probe const&) = delete;
+    probe& operator=(probe const&) = delete;
+
+    ~probe() {
+      if (target)
+        target->comparisons_of(op).add(target->comparisons - start);
+    }
+  };
+
+  stats_sink() = default;
+  explicit stats_sink(Stats* target) : target(target) {}
+
+  void compared() const {
+    if (target)
+      target->comparisons++;
+  }
+  void descended(std::size_t length) const {
+    if (target)
+      target->descent_length.add(length);
+  }
+  void relinked() const {
+    if (target)
+      target->relinks++;
+  }
+  void stepped() const {
+    if (target)
+      target->iterator_steps++;
+  }
+  void allocated() const {
+    if (target)
+      target->allocations++;
+  }
+  void deallocated(std::size_t count) const {
+    if (target)
+      target->deallocations += count;
+  }
+};
+
+} // namespace intrusive
@@ -1,67 +1,131 @@
 #pragma once
 
 #include <algorithm>
-
+#include <bit>
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+
+#include "intrusive_augment.h"
+#include "intrusive_balance.h"
 #include "intrusive_node.h"
+#include "intrusive_stats.h"
 
 namespace intrusive {
 
-template <typename T, typename Compare, typename Tag = default_tag>
+inline void prefetch(void const* p) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(p);
+#else
+  (void)p;
+#endif
+}
+
+// Трехсторонний компаратор (например, std::compare_three_way) возвращает
+// std::weak_ordering или std::strong_ordering вместо bool. Дерево тогда
+// сравнивает ключ с узлом одним вызовом вместо двух.
+template <typename Compare, typename A, typename B>
+concept three_way_compare = requires(Compare const& c, A const& a,
+                                     B const& b) {
+  { c(a, b) } -> std::convertible_to<std::weak_ordering>;
+};
+
+// a < b для обычного и трехстороннего компаратора.
+template <typename Compare, typename A, typename B>
+bool compare_less(Compare const& c, A const& a, B const& b) {
+  if constexpr (three_way_compare<Compare, A, B>)
+    return c(a, b) < 0;
+  else
+    return c(a, b);
+}
+
+// Порядок, в котором стоит разместить в памяти узлы дерева, построенного
+// build_sorted.
+enum class node_layout {
+  // Корень, затем левое и правое поддеревья: спуск влево идет подряд.
+  preorder,
+  // Верхняя половина уровней, затем поддеревья под ней, и так рекурсивно
+  // (van Emde Boas): спуск задевает O(log_B n) блоков памяти для любого
+  // размера блока B -- линии кэша, страницы.
+  van_emde_boas
+};
+
+template <typename T, typename Compare, typename Tag = default_tag,
+          typename Balance = avl_balance, typename Augment = no_augment,
+          typename Links = raw_links, typename Stats = no_stats>
 class intrusive_tree : public Compare {
-  using node_t = node<Tag>;
+  using node_t = node<Tag, Links>;
+  using sink_t = stats_sink<Stats>;
   static_assert(std::is_convertible_v<T*, node_t*>, "invalid value type");
 
-  node_t sentinel;
+  struct updater {
+    static void update(node_t* n) {
+      Augment::template update<T>(n);
+    }
+  };
+
+  typename Links::template sentinel<node_t> sentinel;
+  // Минимальный и максимальный узлы, в пустом дереве -- sentinel.
+  node_t* leftmost = sentinel.get();
+  node_t* rightmost = sentinel.get();
+  [[no_unique_address]] sink_t stats;
 
 public:
+  // Есть ли порядок: bound'ы, порядковые статистики, вставка по подсказке.
+  static constexpr bool ordered = true;
+
   explicit intrusive_tree(Compare compare = Compare{})
       : Compare(std::move(compare)) {}
 
   intrusive_tree(intrusive_tree const& other) = delete;
   intrusive_tree(intrusive_tree&& other) = delete;
 
+  // Куда писать статистику. Принадлежит владельцу дерева и при swap не
+  // переходит.
+  void set_stats(Stats* target) {
+    stats = sink_t(target);
+  }
+
   void swap(intrusive_tree& other) {
     std::swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
-    sentinel.right = nullptr;
-    other.sentinel.right = nullptr;
-    sentinel.swap(other.sentinel);
+    get_sentinel()->right = nullptr;
+    other.get_sentinel()->right = nullptr;
+    get_sentinel()->swap(*other.get_sentinel());
+    std::swap(leftmost, other.leftmost);
+    std::swap(rightmost, other.rightmost);
+    fix_empty_extremes(other);
+    other.fix_empty_extremes(*this);
   }
 
   bool empty() const {
-    return sentinel.left == nullptr;
+    return get_sentinel()->left == nullptr;
   }
 
   node_t* get_sentinel() {
-    return &sentinel;
+    return sentinel.get();
   }
 
 private:
   node_t* get_sentinel() const {
-    return const_cast<node_t*>(&sentinel);
+    return sentinel.get();
   }
 
   template <typename iT>
   class inorder_iterator {
   private:
     node_t* cur = nullptr;
+    [[no_unique_address]] sink_t stats;
 
-    template <typename tT, typename tCompare, typename tTag>
+    template <typename tT, typename tCompare, typename tTag,
+              typename tBalance, typename tAugment, typename tLinks,
+              typename tStats>
     friend class intrusive_tree;
 
-    template <typename tT, typename tCompare, typename tTag>
-    static inorder_iterator
-    begin_iter(const intrusive_tree<tT, tCompare, tTag>* tree) {
-      return (node_t::min_node(tree->get_sentinel()));
-    }
-
-    template <typename tT, typename tCompare, typename tTag>
-    static inorder_iterator
-    end_iter(const intrusive_tree<tT, tCompare, tTag>* tree) {
-      return tree->get_sentinel();
-    }
-
   public:
     inorder_iterator(node_t* cur) : cur(cur) {}
+    inorder_iterator(node_t* cur, sink_t stats) : cur(cur), stats(stats) {}
 
     using difference_type = ptrdiff_t;
     using value_type = iT;
@@ -89,6 +153,10 @@ private:
       return cur;
     }
 
+    sink_t get_stats() const {
+      return stats;
+    }
+
     reference operator*() const {
       return *(static_cast<iT*>(cur));
     }
@@ -98,12 +166,18 @@ private:
     }
 
     inorder_iterator& operator++() {
-      cur = cur->next();
+      if constexpr (Stats::enabled)
+        cur = node_t::next_node(cur, [this] { stats.stepped(); });
+      else
+        cur = cur->next();
       return *this;
     }
 
     inorder_iterator& operator--() {
-      cur = cur->prev();
+      if constexpr (Stats::enabled)
+        cur = node_t::prev_node(cur, [this] { stats.stepped(); });
+      else
+        cur = cur->prev();
       return *this;
     }
 
@@ -125,11 +199,22 @@ public:
   using const_iterator = inorder_iterator<const T>;
 
   iterator begin() const {
-    return iterator::template begin_iter<T, Compare, Tag>(this);
+    return iterator_at(leftmost);
   }
 
   iterator end() const {
-    return iterator::template end_iter<T, Compare, Tag>(this);
+    return iterator_at(get_sentinel());
+  }
+
+  // Итератор на максимальный узел, end() для пустого дерева. O(1).
+  iterator last() const {
+    return iterator_at(rightmost);
+  }
+
+  // Итератор на узел этого дерева или на sentinel, пишущий статистику
+  // дерева.
+  iterator iterator_at(node_t* n) const {
+    return iterator(n, stats);
   }
 
   static const T* make_p(node_t* p) {
@@ -140,38 +225,52 @@ public:
     return static_cast<T&>(p);
   }
 
+  template <typename key>
+  bool is_less(const key& a, const key& b) const {
+    return less(a, b);
+  }
+
   template <typename key>
   bool is_equals(const key& a, const key& b) const
   {
-    if (Compare::operator()(a, b))
-      return false;
-    if (Compare::operator()(b, a))
-      return false;
-    return true;
+    return order(a, b) == 0;
   }
 
-private:
+  // Равенство для проверок в assert: не пишет статистику.
+  template <typename A, typename B>
+  bool matches(A const& a, B const& b) const {
+    auto const& c = static_cast<Compare const&>(*this);
+    return !compare_less(c, a, b) && !compare_less(c, b, a);
+  }
+
+  // Результат спуска: найденный узел или место, куда подвешивать новый.
   struct find_result {
     enum { THERE_IS, ADD_RIGHT, ADD_LEFT } flag;
     node_t* node;
   };
 
+  // Ключи поиска принимаются по ссылке и никогда не копируются.
   template <class fT>
-  find_result find_with_result(fT data) const {
+  find_result find_with_result(fT&& data) const {
     find_result res = {find_result::ADD_LEFT, get_sentinel()};
-    if (sentinel.left == nullptr)
+    if (get_sentinel()->left == nullptr) {
+      stats.descended(0);
       return res;
+    }
 
-    node_t* cur = sentinel.left;
+    node_t* cur = get_sentinel()->left;
+    std::size_t depth = 0;
     while (cur != nullptr) {
-      if (Compare::operator()(make_r(*cur).key, data)) {
+      depth++;
+      std::weak_ordering c = order(make_r(*cur).key, data);
+      if (c < 0) {
         if (cur->right)
           cur = cur->right;
         else {
           res.flag = find_result::ADD_RIGHT;
           break;
         }
-      } else if (Compare::operator()(data, make_r(*cur).key)) {
+      } else if (c > 0) {
         if (cur->left)
           cur = cur->left;
         else {
@@ -183,64 +282,422 @@ private:
         break;
       }
     }
+    stats.descended(depth);
     res.node = cur;
     return res;
   }
 
-public:
+  // Как find_with_result, но сначала проверяет место непосредственно перед
+  // hint и конец дерева (как std::map::emplace_hint). Если data попадает
+  // туда, спуска от корня не происходит.
   template <class fT>
-  iterator find(fT x) const {
-    find_result res = find_with_result<fT>(x);
+  find_result find_with_hint(iterator hint, fT&& data) const {
+    if (empty())
+      return find_with_result(data);
+    node_t* h = hint.cur;
+    if (h == get_sentinel()) {
+      if (less(make_r(*rightmost).key, data))
+        return {find_result::ADD_RIGHT, rightmost};
+      return find_with_result(data);
+    }
+    std::weak_ordering c = order(data, make_r(*h).key);
+    if (c < 0) {
+      if (h == leftmost)
+        return {find_result::ADD_LEFT, h};
+      node_t* prev = h->prev();
+      if (less(make_r(*prev).key, data)) {
+        if (h->left == nullptr)
+          return {find_result::ADD_LEFT, h};
+        return {find_result::ADD_RIGHT, prev};
+      }
+    } else if (c > 0) {
+      node_t* next = h->next();
+      if (next == get_sentinel() ||
+          less(data, make_r(*next).key)) {
+        if (h->right == nullptr)
+          return {find_result::ADD_RIGHT, h};
+        return {find_result::ADD_LEFT, next};
+      }
+    } else {
+      return {find_result::THERE_IS, h};
+    }
+    if (less(make_r(*rightmost).key, data))
+      return {find_result::ADD_RIGHT, rightmost};
+    return find_with_result(data);
+  }
+
+  template <class fT>
+  iterator find(fT&& x) const {
+    find_result res = find_with_result(x);
     if (res.flag == find_result::THERE_IS)
-      return (res.node);
+      return iterator_at(res.node);
 
     return end();
   }
 
+  // Ищет keys[0..n) и передает результаты в out(i, iterator). Поиски идут
+  // группами по batch_group: за шаг каждый поиск группы спускается на один
+  // уровень и запрашивает prefetch следующего узла, так что промахи кэша
+  // разных поисков перекрываются.
+  static constexpr std::size_t batch_group = 16;
+
+  template <class fT, typename Out>
+  void find_batch(fT const* keys, std::size_t n, Out out) const {
+    node_t* cur[batch_group];
+    std::size_t lanes[batch_group];
+    std::size_t depth[batch_group];
+    for (std::size_t base = 0; base < n; base += batch_group) {
+      std::size_t pending = std::min(batch_group, n - base);
+      for (std::size_t i = 0; i < pending; i++) {
+        cur[i] = get_sentinel()->left;
+        lanes[i] = i;
+        depth[i] = 0;
+      }
+      while (pending != 0) {
+        std::size_t still = 0;
+        for (std::size_t j = 0; j < pending; j++) {
+          std::size_t i = lanes[j];
+          node_t* c = cur[i];
+          if (c == nullptr) {
+            stats.descended(depth[i]);
+            out(base + i, end());
+            continue;
+          }
+          depth[i]++;
+          std::weak_ordering o = order(make_r(*c).key, keys[base + i]);
+          if (o < 0) {
+            c = c->right;
+          } else if (o > 0) {
+            c = c->left;
+          } else {
+            stats.descended(depth[i]);
+            out(base + i, iterator_at(c));
+            continue;
+          }
+          prefetch(c);
+          cur[i] = c;
+          lanes[still++] = i;
+        }
+        pending = still;
+      }
+    }
+  }
+
   template <class lbT>
-  iterator lower_bound(lbT x) const {
-    find_result res = find_with_result<lbT>(x);
+  iterator lower_bound(lbT&& x) const {
+    find_result res = find_with_result(x);
     if (res.flag == find_result::THERE_IS || res.flag == find_result::ADD_LEFT)
-      return (res.node);
-    return (res.node->next());
+      return iterator_at(res.node);
+    return iterator_at(res.node->next());
   }
 
   template <class ubT>
-  iterator upper_bound(ubT x) const {
-    find_result res = find_with_result<ubT>(x);
+  iterator upper_bound(ubT&& x) const {
+    find_result res = find_with_result(x);
     if (res.flag == find_result::ADD_LEFT)
-      return (res.node);
-    return (res.node->next());
+      return iterator_at(res.node);
+    return iterator_at(res.node->next());
   }
 
-  template <class inT>
   iterator insert(node_t& data) {
-    find_result res = find_with_result<inT>(make_r(data).key);
+    find_result res = find_with_result(make_r(data).key);
     if (res.flag == find_result::THERE_IS)
       return end();
+    return insert_at(res, data);
+  }
 
-    static_cast<node_t*>(&data)->parent = res.node;
+  // Подвешивает data в место, найденное find_with_result, без повторного
+  // спуска. Между поиском и вставкой дерево не должно меняться.
+  iterator insert_at(find_result res, node_t& data) {
+    data.parent = res.node;
+    data.left = nullptr;
+    data.right = nullptr;
     if (res.flag == find_result::ADD_LEFT) {
       res.node->left = &data;
-      return (res.node->left);
+      if (res.node == leftmost || res.node == get_sentinel())
+        leftmost = &data;
+      if (res.node == get_sentinel())
+        rightmost = &data;
     } else { /// res == ADD_RIGHT)
       res.node->right = &data;
-      return (res.node->right);
+      if (res.node == rightmost)
+        rightmost = &data;
     }
+    Balance::init(&data);
+    Augment::template init<T>(&data);
+    Augment::template add_path<T>(res.node, 1);
+    Balance::template after_insert<updater>(&data);
+    stats.relinked();
+    return iterator_at(&data);
+  }
+
+  // Переносит узел n дерева на место pos, найденное find_with_result для
+  // ключа, который rekey() запишет в n. Место определяется соседями,
+  // вычисленными до вырезания n, так что ключи больше не сравниваются и,
+  // если rekey не бросает, relocate тоже. Если новый ключ встает между
+  // прежними соседями n, узел остается на месте.
+  template <typename Rekey>
+  void relocate(node_t* n, find_result pos, Rekey rekey) {
+    node_t* s = get_sentinel();
+    node_t* prev;
+    node_t* next;
+    if (pos.flag == find_result::ADD_RIGHT) {
+      prev = pos.node;
+      next = prev->next();
+    } else {
+      next = pos.node;
+      prev = next == leftmost ? s : next->prev();
+    }
+    if (prev == n || next == n) {
+      rekey();
+      return;
+    }
+    unlink(n);
+    rekey();
+    insert_at(slot_between(prev, next), *n);
+  }
+
+  // Вырезает n и возвращает место, которое find_with_result нашел бы
+  // теперь для ключа n, не сравнивая ключей.
+  find_result unlink_to_slot(node_t* n) {
+    node_t* prev = n == leftmost ? get_sentinel() : n->prev();
+    node_t* next = n->next();
+    unlink(n);
+    return slot_between(prev, next);
   }
 
   iterator remove(iterator it) {
-    iterator it_next(it.cur->next());
-    it.cur->unlink();
+    iterator it_next = iterator_at(it.cur->next());
+    unlink(it.cur);
     return it_next;
   }
 
   template <class rT>
-  iterator remove(rT data) {
-    find_result res = find_with_result<rT>(data);
-    if (res.flag == find_result::THERE_IS)
+    requires(!std::is_convertible_v<rT, iterator>)
+  iterator remove(rT&& data) {
+    find_result res = find_with_result(data);
+    if (res.flag != find_result::THERE_IS)
       return end();
-    return remove(iterator(res.node));
+    return remove(iterator_at(res.node));
+  }
+
+  // Строит идеально сбалансированное дерево из узлов [first, last),
+  // упорядоченных по возрастанию ключа без повторов, за линейное время.
+  // Дерево должно быть пустым.
+  template <typename It>
+  void build_sorted(It first, It last) {
+    std::size_t n = last - first;
+    if (n == 0)
+      return;
+    int max_depth = 0;
+    while ((std::size_t(2) << max_depth) <= n)
+      max_depth++;
+    int height;
+    get_sentinel()->left = build_subtree(first, n, 0, max_depth, height);
+    get_sentinel()->left->parent = get_sentinel();
+    leftmost = *first;
+    rightmost = *(first + (n - 1));
+  }
+
+  // Вызывает visit(i) для всех i из [0, n) в порядке layout, где i --
+  // номер по возрастанию ключа узла дерева, которое build_sorted строит
+  // из n узлов.
+  template <typename Visit>
+  static void for_each_built(std::size_t n, node_layout layout,
+                             Visit visit) {
+    if (layout == node_layout::preorder)
+      visit_preorder(0, n, visit);
+    else
+      visit_veb(0, n, std::bit_width(n), visit);
+  }
+
+  // Забывает все узлы, не трогая их связи.
+  void reset() {
+    get_sentinel()->left = nullptr;
+    leftmost = rightmost = get_sentinel();
+  }
+
+  // Отдает все узлы в dispose в порядке post-order и оставляет дерево пустым.
+  // Связи узлов не восстанавливаются и балансировка не выполняется.
+  template <typename Dispose>
+  void clear_and_dispose(Dispose dispose) {
+    node_t* cur = get_sentinel()->left;
+    while (cur != nullptr) {
+      if (cur->left) {
+        cur = std::exchange(cur->left, nullptr);
+      } else if (cur->right) {
+        cur = std::exchange(cur->right, nullptr);
+      } else {
+        node_t* parent = cur->parent;
+        dispose(static_cast<T*>(cur));
+        cur = parent == get_sentinel() ? nullptr : parent;
+      }
+    }
+    reset();
+  }
+
+  // Количество узлов, ключ которых меньше ключа it. Для end() -- размер
+  // дерева.
+  std::size_t rank(iterator it) const
+    requires Augment::counted
+  {
+    node_t* n = it.cur;
+    if (n->parent == nullptr)
+      return size();
+    std::size_t res = subtree_size(n->left);
+    for (; n->parent->parent != nullptr; n = n->parent) {
+      if (n->is_right())
+        res += subtree_size(n->parent->left) + 1;
+    }
+    return res;
+  }
+
+  // Итератор на k-й по порядку узел (с нуля), end() если k >= size().
+  iterator select(std::size_t k) const
+    requires Augment::counted
+  {
+    node_t* cur = get_sentinel()->left;
+    while (cur != nullptr) {
+      std::size_t left_size = subtree_size(cur->left);
+      if (k < left_size) {
+        cur = cur->left;
+      } else if (k == left_size) {
+        return iterator_at(cur);
+      } else {
+        k -= left_size + 1;
+        cur = cur->right;
+      }
+    }
+    return end();
+  }
+
+  std::size_t size() const
+    requires Augment::counted
+  {
+    return subtree_size(get_sentinel()->left);
+  }
+
+  // Вырезает узел из дерева, не трогая его соседей по другим деревьям.
+  void unlink(node_t* n) {
+    if (n == leftmost)
+      leftmost = n->next();
+    if (n == rightmost)
+      rightmost = n->prev();
+    if (n->left && n->right) {
+      node_t* next = node_t::min_node(n->right);
+      Balance::exchange_with_successor(n, next);
+      Augment::template exchange<T>(n, next);
+      stats.relinked();
+    }
+    Augment::template add_path<T, node_t>(n->parent, -1);
+    Balance::template erase<updater>(n);
+    n->parent = n->left = n->right = nullptr;
+    stats.relinked();
+  }
+
+private:
+  // Место между соседними по порядку узлами prev и next (sentinel --
+  // край): у prev нет правого сына или у next -- левого.
+  find_result slot_between(node_t* prev, node_t* next) const {
+    if (prev != get_sentinel() && prev->right == nullptr)
+      return {find_result::ADD_RIGHT, prev};
+    return {find_result::ADD_LEFT, next};
+  }
+
+  template <typename A, typename B>
+  bool less(A const& a, B const& b) const {
+    stats.compared();
+    return compare_less(static_cast<Compare const&>(*this), a, b);
+  }
+
+  // Один вызов трехстороннего компаратора или до двух вызовов обычного.
+  template <typename A, typename B>
+  std::weak_ordering order(A const& a, B const& b) const {
+    if constexpr (three_way_compare<Compare, A, B>) {
+      stats.compared();
+      return Compare::operator()(a, b);
+    } else {
+      if (less(a, b))
+        return std::weak_ordering::less;
+      if (less(b, a))
+        return std::weak_ordering::greater;
+      return std::weak_ordering::equivalent;
+    }
+  }
+
+  // После swap пустое дерево должно ссылаться на свой sentinel, а не на
+  // sentinel другого дерева.
+  void fix_empty_extremes(intrusive_tree& other) {
+    if (leftmost == other.get_sentinel())
+      leftmost = rightmost = get_sentinel();
+  }
+
+  static std::size_t subtree_size(node_t* n) {
+    return Augment::template size<T>(n);
+  }
+
+  // Обходы дерева build_subtree по номерам узлов: корень поддерева
+  // [first, first + n) -- first + n / 2.
+  template <typename Visit>
+  static void visit_preorder(std::size_t first, std::size_t n,
+                             Visit& visit) {
+    if (n == 0)
+      return;
+    std::size_t mid = n / 2;
+    visit(first + mid);
+    visit_preorder(first, mid, visit);
+    visit_preorder(first + mid + 1, n - mid - 1, visit);
+  }
+
+  // Верхние levels уровней поддерева в порядке van Emde Boas.
+  template <typename Visit>
+  static void visit_veb(std::size_t first, std::size_t n, int levels,
+                        Visit& visit) {
+    if (n == 0)
+      return;
+    if (levels == 1) {
+      visit(first + n / 2);
+      return;
+    }
+    int top = levels / 2;
+    visit_veb(first, n, top, visit);
+    visit_below(first, n, top, levels - top, visit);
+  }
+
+  // Верхние levels уровней каждого поддерева на глубине depth, слева
+  // направо.
+  template <typename Visit>
+  static void visit_below(std::size_t first, std::size_t n, int depth,
+                          int levels, Visit& visit) {
+    if (n == 0)
+      return;
+    if (depth == 0) {
+      visit_veb(first, n, levels, visit);
+      return;
+    }
+    std::size_t mid = n / 2;
+    visit_below(first, mid, depth - 1, levels, visit);
+    visit_below(first + mid + 1, n - mid - 1, depth - 1, levels, visit);
+  }
+
+  template <typename It>
+  static node_t* build_subtree(It first, std::size_t n, int depth,
+                               int max_depth, int& height) {
+    if (n == 0) {
+      height = 0;
+      return nullptr;
+    }
+    std::size_t mid = n / 2;
+    node_t* root = *(first + mid);
+    int left_height, right_height;
+    root->left = build_subtree(first, mid, depth + 1, max_depth, left_height);
+    root->right = build_subtree(first + mid + 1, n - mid - 1, depth + 1,
+                                max_depth, right_height);
+    root->repair_childs();
+    height = 1 + std::max(left_height, right_height);
+    Balance::init_built(root, height, depth, max_depth);
+    Augment::template update<T>(root);
+    return root;
   }
 };
 } // namespace intrusive
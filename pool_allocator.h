@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace details {
+
+// Пул блоков одинакового размера: память выделяется слябами, растущими
+// вдвое, освобожденные блоки уходят в односвязный free list.
+class slab_pool {
+  struct free_block {
+    free_block* next;
+  };
+
+  static constexpr std::size_t first_slab = 16;
+  static constexpr std::size_t max_slab = 1 << 16;
+
+  std::size_t block_size;
+  std::size_t block_align;
+  std::size_t next_slab = first_slab;
+
+  free_block* free_list = nullptr;
+  char* cur = nullptr;
+  char* last = nullptr;
+  std::vector<void*> slabs;
+
+public:
+  slab_pool(std::size_t size, std::size_t align)
+      : block_size(std::max(size, sizeof(free_block))),
+        block_align(std::max(align, alignof(free_block))) {
+    block_size = (block_size + block_align - 1) / block_align * block_align;
+  }
+
+  slab_pool(slab_pool const&) = delete;
+  slab_pool& operator=(slab_pool const&) = delete;
+
+  ~slab_pool() {
+    for (void* slab : slabs)
+      ::operator delete(slab, std::align_val_t(block_align));
+  }
+
+  void* allocate() {
+    if (free_list) {
+      free_block* res = free_list;
+      free_list = res->next;
+      return res;
+    }
+    if (cur == last)
+      add_slab();
+    void* res = cur;
+    cur += block_size;
+    return res;
+  }
+
+  void deallocate(void* p) noexcept {
+    auto* block = static_cast<free_block*>(p);
+    block->next = free_list;
+    free_list = block;
+  }
+
+private:
+  void add_slab() {
+    slabs.reserve(slabs.size() + 1);
+    std::size_t bytes = block_size * next_slab;
+    cur = static_cast<char*>(
+        ::operator new(bytes, std::align_val_t(block_align)));
+    last = cur + bytes;
+    slabs.push_back(cur);
+    next_slab = std::min(next_slab * 2, max_slab);
+  }
+};
+
+// Пулы блоков разных размеров, общие для всех копий и ребиндов одного
+// pool_allocator.
+class slab_pools {
+  struct entry {
+    std::size_t size;
+    std::size_t align;
+    std::unique_ptr<slab_pool> pool;
+  };
+
+  std::vector<entry> pools;
+
+public:
+  slab_pool& get(std::size_t size, std::size_t align) {
+    for (entry& e : pools)
+      if (e.size == size && e.align == align)
+        return *e.pool;
+    pools.reserve(pools.size() + 1);
+    pools.push_back({size, align, std::make_unique<slab_pool>(size, align)});
+    return *pools.back().pool;
+  }
+
+  void clear() noexcept {
+    pools.clear();
+  }
+};
+
+} // namespace details
+
+// Аллокатор узлов bimap: одиночные объекты берутся из общего для всех копий
+// аллокатора пула, массивы -- из глобального operator new.
+// Общий набор пулов создается вместе с аллокатором, так что копии равны
+// друг другу с самого начала и навсегда; сами блоки выделяются при первой
+// аллокации. Ребинд на другой тип делит пулы с исходным аллокатором и равен
+// ему, а блоки своего размера берет из отдельного пула.
+template <typename T>
+class pool_allocator {
+  template <typename U>
+  friend class pool_allocator;
+
+  std::shared_ptr<details::slab_pools> pools =
+      std::make_shared<details::slab_pools>();
+  // Пул для блоков под T из pools, находится при первом обращении.
+  details::slab_pool* pool = nullptr;
+
+  details::slab_pool& own_pool() {
+    if (!pool)
+      pool = &pools->get(sizeof(T), alignof(T));
+    return *pool;
+  }
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  pool_allocator() = default;
+  pool_allocator(pool_allocator const&) noexcept = default;
+  pool_allocator& operator=(pool_allocator const&) noexcept = default;
+
+  template <typename U>
+  explicit pool_allocator(pool_allocator<U> const& other) noexcept
+      : pools(other.pools) {}
+
+  // Копия bimap получает свой пул, а не делит его с оригиналом.
+  pool_allocator select_on_container_copy_construction() const {
+    return pool_allocator();
+  }
+
+  T* allocate(std::size_t n) {
+    if (n != 1)
+      return std::allocator<T>().allocate(n);
+    return static_cast<T*>(own_pool().allocate());
+  }
+
+  void deallocate(T* p, std::size_t n) noexcept {
+    if (n != 1)
+      std::allocator<T>().deallocate(p, n);
+    else
+      own_pool().deallocate(p);
+  }
+
+  // Освобождает весь пул разом, если им больше не пользуется ни одна копия
+  // аллокатора. Все выделенные из пула объекты должны быть уже мертвы.
+  bool release() noexcept {
+    if (pools.use_count() != 1)
+      return false;
+    pools->clear();
+    pool = nullptr;
+    return true;
+  }
+
+  template <typename U>
+  bool operator==(pool_allocator<U> const& other) const noexcept {
+    return pools == other.pools;
+  }
+  template <typename U>
+  bool operator!=(pool_allocator<U> const& other) const noexcept {
+    return !(*this == other);
+  }
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+// bimap для многих писателей: пары разложены по shard'ам, у каждого свой
+// мьютекс. Пара лежит в by_left shard'а своего left и в by_right shard'а
+// своего right, так что поиск с любой стороны берет одну блокировку, а
+// уникальность обеих сторон проверяется под блокировками двух shard'ов,
+// захваченными вместе через std::scoped_lock. Пары хранятся дважды, в
+// односторонних хеш-таблицах: by_left ищет только по left, by_right --
+// только по right.
+template <typename Left, typename Right, typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>>
+class sharded_bimap {
+  using left_map_t = std::unordered_map<Left, Right, HashLeft>;
+  using right_map_t = std::unordered_map<Right, Left, HashRight>;
+
+  struct alignas(64) shard {
+    mutable std::mutex mutex;
+    left_map_t by_left;
+    right_map_t by_right;
+  };
+
+  std::unique_ptr<shard[]> shards;
+  std::size_t n_shards;
+  [[no_unique_address]] HashLeft hash_left;
+  [[no_unique_address]] HashRight hash_right;
+  std::atomic<std::size_t> n_pairs{0};
+
+  shard& left_shard(Left const& left) const {
+    return shards[hash_left(left) % n_shards];
+  }
+  shard& right_shard(Right const& right) const {
+    return shards[hash_right(right) % n_shards];
+  }
+
+  template <typename F>
+  static auto locked(shard& a, shard& b, F f) {
+    if (&a == &b) {
+      std::lock_guard<std::mutex> lock(a.mutex);
+      return f();
+    }
+    std::scoped_lock lock(a.mutex, b.mutex);
+    return f();
+  }
+
+  static std::size_t checked_count(std::size_t shard_count) {
+    if (shard_count == 0)
+      throw std::invalid_argument("sharded_bimap: shard_count == 0");
+    return shard_count;
+  }
+
+public:
+  // shard_count должен быть положительным, иначе std::invalid_argument.
+  explicit sharded_bimap(std::size_t shard_count = 64,
+                         HashLeft hash_left = HashLeft(),
+                         HashRight hash_right = HashRight())
+      : shards(new shard[checked_count(shard_count)]), n_shards(shard_count),
+        hash_left(std::move(hash_left)), hash_right(std::move(hash_right)) {}
+
+  sharded_bimap(sharded_bimap const&) = delete;
+  sharded_bimap& operator=(sharded_bimap const&) = delete;
+
+  std::size_t shard_count() const {
+    return n_shards;
+  }
+
+  // Количество пар; при параллельных изменениях -- на какой-то момент.
+  std::size_t size() const {
+    return n_pairs.load();
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  // Вставка пары, если ни left, ни right еще нет. Возвращает, была ли
+  // вставка.
+  bool insert(Left const& left, Right const& right) {
+    shard& ls = left_shard(left);
+    shard& rs = right_shard(right);
+    return locked(ls, rs, [&] {
+      if (ls.by_left.contains(left) || rs.by_right.contains(right))
+        return false;
+      auto it = ls.by_left.emplace(left, right).first;
+      try {
+        rs.by_right.emplace(right, left);
+      } catch (...) {
+        ls.by_left.erase(it);
+        throw;
+      }
+      n_pairs++;
+      return true;
+    });
+  }
+
+  // Копия парного элемента или nullopt.
+  std::optional<Right> find_left(Left const& left) const {
+    shard& ls = left_shard(left);
+    std::lock_guard<std::mutex> lock(ls.mutex);
+    auto it = ls.by_left.find(left);
+    if (it == ls.by_left.end())
+      return std::nullopt;
+    return it->second;
+  }
+  std::optional<Left> find_right(Right const& right) const {
+    shard& rs = right_shard(right);
+    std::lock_guard<std::mutex> lock(rs.mutex);
+    auto it = rs.by_right.find(right);
+    if (it == rs.by_right.end())
+      return std::nullopt;
+    return it->second;
+  }
+
+  // Удаление пары по ключу. Второй shard известен только после поиска,
+  // поэтому пара перепроверяется под обеими блокировками.
+  bool erase_left(Left const& left) {
+    shard& ls = left_shard(left);
+    for (;;) {
+      std::optional<Right> right = find_left(left);
+      if (!right)
+        return false;
+      shard& rs = right_shard(*right);
+      std::optional<bool> res = locked(ls, rs, [&]() -> std::optional<bool> {
+        auto it = ls.by_left.find(left);
+        if (it == ls.by_left.end())
+          return false;
+        if (!(it->second == *right))
+          return std::nullopt;
+        rs.by_right.erase(*right);
+        ls.by_left.erase(it);
+        n_pairs--;
+        return true;
+      });
+      if (res)
+        return *res;
+    }
+  }
+
+  bool erase_right(Right const& right) {
+    shard& rs = right_shard(right);
+    for (;;) {
+      std::optional<Left> left = find_right(right);
+      if (!left)
+        return false;
+      shard& ls = left_shard(*left);
+      std::optional<bool> res = locked(ls, rs, [&]() -> std::optional<bool> {
+        auto it = rs.by_right.find(right);
+        if (it == rs.by_right.end())
+          return false;
+        if (!(it->second == *left))
+          return std::nullopt;
+        ls.by_left.erase(*left);
+        rs.by_right.erase(it);
+        n_pairs--;
+        return true;
+      });
+      if (res)
+        return *res;
+    }
+  }
+
+  // Вызывает f(left, right) для всех пар, обходя shard'ы по очереди под их
+  // блокировками. При параллельных изменениях это не снимок. Из f нельзя
+  // обращаться к этому же sharded_bimap.
+  template <typename F>
+  void for_each(F f) const {
+    for (std::size_t i = 0; i < n_shards; i++) {
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      for (auto const& [left, right] : shards[i].by_left)
+        f(left, right);
+    }
+  }
+};
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <compare>
+#include <cstddef>
+#include <memory>
+
 struct test_object {
   int a = 0;
   test_object() = default;
@@ -15,6 +19,44 @@ struct test_object {
   }
 };
 
+struct copy_counting {
+  static inline size_t copies = 0;
+
+  int a = 0;
+  explicit copy_counting(int b) : a(b) {}
+  copy_counting(copy_counting const& other) : a(other.a) {
+    copies++;
+  }
+  copy_counting(copy_counting&& other) noexcept = default;
+  friend bool operator<(copy_counting const& c, copy_counting const& b) {
+    return c.a < b.a;
+  }
+};
+
+// Ключ, который дорого создавать: считает конструирования и перемещения.
+// Сравним с int, чтобы искать его без создания.
+struct emplace_counting {
+  static inline size_t constructions = 0;
+  static inline size_t moves = 0;
+
+  int a = 0;
+  emplace_counting(int b, int c) : a(b + c) {
+    constructions++;
+  }
+  emplace_counting(emplace_counting&& other) noexcept : a(other.a) {
+    moves++;
+  }
+  friend bool operator<(emplace_counting const& c, emplace_counting const& b) {
+    return c.a < b.a;
+  }
+  friend bool operator<(emplace_counting const& c, int b) {
+    return c.a < b;
+  }
+  friend bool operator<(int c, emplace_counting const& b) {
+    return c < b.a;
+  }
+};
+
 struct vector_compare {
   using vec = std::pair<int, int>;
   enum distance_type { euclidean, manhattan };
@@ -57,3 +99,61 @@ struct non_default_constructible {
 private:
   int a;
 };
+
+struct allocation_stats {
+  size_t allocations = 0;
+  size_t deallocations = 0;
+};
+
+template <typename T>
+struct counting_allocator {
+  using value_type = T;
+
+  allocation_stats* stats;
+
+  explicit counting_allocator(allocation_stats* s) : stats(s) {}
+  template <typename U>
+  explicit counting_allocator(counting_allocator<U> const& other)
+      : stats(other.stats) {}
+
+  T* allocate(size_t n) {
+    stats->allocations += n;
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, size_t n) {
+    stats->deallocations += n;
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(counting_allocator<U> const& other) const {
+    return stats == other.stats;
+  }
+  template <typename U>
+  bool operator!=(counting_allocator<U> const& other) const {
+    return stats != other.stats;
+  }
+};
+
+struct counting_compare {
+  size_t* calls;
+
+  explicit counting_compare(size_t* c) : calls(c) {}
+
+  bool operator()(int a, int b) const {
+    ++*calls;
+    return a < b;
+  }
+};
+
+// Трехсторонний компаратор, упорядочивающий по убыванию и считающий вызовы.
+struct counting_three_way {
+  size_t* calls;
+
+  explicit counting_three_way(size_t* c) : calls(c) {}
+
+  std::strong_ordering operator()(int a, int b) const {
+    ++*calls;
+    return b <=> a;
+  }
+};
@@ -1,9 +1,33 @@
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <optional>
 #include <random>
+#include <string>
+#include <string_view>
+#include <thread>
 
 #include "bimap.h"
+#include "compact_allocator.h"
+#include "concurrent_bimap.h"
+#include "frozen_bimap.h"
+#include "pool_allocator.h"
+#include "sharded_bimap.h"
 #include "test-classes.h"
 #include "gtest/gtest.h"
 
+template <typename It>
+size_t tree_height(It begin, It end) {
+  size_t height = 0;
+  for (auto it = begin; it != end; it++) {
+    size_t depth = 0;
+    for (auto* n = it.it_tree.get_node(); n->parent != nullptr; n = n->parent)
+      depth++;
+    height = std::max(height, depth);
+  }
+  return height;
+}
+
 TEST(bimap, leak_check) {
   bimap<unsigned long, unsigned long> b;
 
@@ -365,6 +389,1540 @@ TEST(bimap, swap) {
   EXPECT_EQ(*b.find_right(3), 3);
 }
 
+TEST(bimap, insert_single_probe) {
+  size_t calls = 0;
+  bimap<int, int, counting_compare, counting_compare> b(
+      (counting_compare(&calls)), counting_compare(&calls));
+  std::mt19937 e(1337);
+  for (int i = 0; i < 1000; i++) {
+    int l = e() % 10000, r = e() % 10000;
+    calls = 0;
+    bool absent = b.find_left(l) == b.end_left() &&
+                  b.find_right(r) == b.end_right();
+    size_t probe_calls = calls;
+
+    calls = 0;
+    auto it = b.insert(l, r);
+    EXPECT_EQ(it != b.end_left(), absent);
+    if (absent)
+      EXPECT_EQ(calls, probe_calls);
+    else
+      EXPECT_LE(calls, probe_calls);
+  }
+}
+
+TEST(bimap, hinted_insert_append) {
+  size_t calls = 0;
+  bimap<int, int, counting_compare, counting_compare> b(
+      (counting_compare(&calls)), counting_compare(&calls));
+  for (int i = 0; i < 10000; i++) {
+    calls = 0;
+    auto it = b.insert(b.end_left(), b.begin_right(), i, -i);
+    EXPECT_NE(it, b.end_left());
+    EXPECT_LE(calls, 4);
+  }
+  EXPECT_EQ(b.size(), 10000);
+  EXPECT_EQ(*b.begin_left(), 0);
+  EXPECT_EQ(*b.begin_right(), -9999);
+  EXPECT_LE(tree_height(b.begin_left(), b.end_left()),
+            1.45 * std::log2(b.size() + 2));
+
+  EXPECT_EQ(b.insert(b.end_left(), b.end_right(), 5, 100), b.end_left());
+  EXPECT_EQ(b.insert(b.end_left(), b.end_right(), 10000, -5), b.end_left());
+  EXPECT_EQ(b.size(), 10000);
+}
+
+TEST(bimap, hinted_insert_random_hints) {
+  bimap<int, int> b;
+  std::map<int, int> left_view, right_view;
+  std::mt19937 e(4242);
+  for (int i = 0; i < 20000; i++) {
+    int l = e() % 5000, r = e() % 5000;
+    if (e() % 4 == 0 && !b.empty()) {
+      b.erase_left(b.begin_left());
+      right_view.erase(left_view.begin()->second);
+      left_view.erase(left_view.begin());
+      continue;
+    }
+    auto hint_left =
+        e() % 2 ? b.lower_bound_left(l) : b.find_left(e() % 5000);
+    auto hint_right = b.lower_bound_right(e() % 5000);
+    bool absent = !left_view.count(l) && !right_view.count(r);
+    EXPECT_EQ(b.insert(hint_left, hint_right, l, r) != b.end_left(), absent);
+    if (absent) {
+      left_view.emplace(l, r);
+      right_view.emplace(r, l);
+    }
+  }
+  ASSERT_EQ(b.size(), left_view.size());
+  auto it = b.begin_left();
+  for (auto [l, r] : left_view) {
+    EXPECT_EQ(*it, l);
+    EXPECT_EQ(*it.flip(), r);
+    ++it;
+  }
+  auto rit = b.begin_right();
+  for (auto [r, l] : right_view) {
+    EXPECT_EQ(*rit, r);
+    ++rit;
+  }
+}
+
+TEST(bimap, front_back) {
+  bimap<int, int> b;
+  std::map<int, int> left_view;
+  std::mt19937 e(777);
+  for (int i = 0; i < 5000; i++) {
+    int l = e() % 1000;
+    if (e() % 3 == 0) {
+      if (left_view.erase(l))
+        b.erase_left(l);
+    } else if (b.insert(l, -l) != b.end_left()) {
+      left_view.emplace(l, -l);
+    }
+    if (left_view.empty()) {
+      EXPECT_EQ(b.begin_left(), b.end_left());
+      EXPECT_EQ(b.begin_right(), b.end_right());
+      continue;
+    }
+    EXPECT_EQ(b.front_left(), left_view.begin()->first);
+    EXPECT_EQ(b.back_left(), left_view.rbegin()->first);
+    EXPECT_EQ(b.front_right(), left_view.rbegin()->second);
+    EXPECT_EQ(b.back_right(), left_view.begin()->second);
+  }
+
+  bimap<int, int> c;
+  c.insert(42, 24);
+  int front = b.front_left(), back = b.back_left();
+  b.swap(c);
+  EXPECT_EQ(b.front_left(), 42);
+  EXPECT_EQ(b.back_right(), 24);
+  EXPECT_EQ(c.front_left(), front);
+  EXPECT_EQ(c.back_left(), back);
+
+  bimap<int, int> d;
+  d.swap(b);
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  EXPECT_EQ(b.begin_right(), b.end_right());
+  EXPECT_EQ(d.front_left(), 42);
+
+  bimap<int, int> moved(std::move(c));
+  EXPECT_EQ(c.begin_left(), c.end_left());
+  EXPECT_EQ(moved.front_left(), front);
+  moved.clear();
+  EXPECT_EQ(moved.begin_left(), moved.end_left());
+  EXPECT_EQ(moved.begin_right(), moved.end_right());
+  moved.insert(1, 2);
+  EXPECT_EQ(moved.front_left(), 1);
+  EXPECT_EQ(moved.back_right(), 2);
+}
+
+TEST(bimap, find_batch) {
+  bimap<int, int> b;
+  std::vector<int> lefts, rights;
+  EXPECT_NO_THROW(b.find_left_batch({}, {}));
+  std::mt19937 e(31337);
+  for (int i = 0; i < 3000; i++) {
+    int l = e() % 4000, r = e() % 4000;
+    b.insert(l, r);
+    lefts.push_back(e() % 4000);
+    rights.push_back(e() % 4000);
+  }
+  std::vector<bimap<int, int>::left_iterator> left_res(lefts.size());
+  std::vector<bimap<int, int>::right_iterator> right_res(rights.size());
+  b.find_left_batch(lefts, left_res);
+  b.find_right_batch(rights, right_res);
+  for (size_t i = 0; i < lefts.size(); i++) {
+    EXPECT_EQ(left_res[i], b.find_left(lefts[i]));
+    EXPECT_EQ(right_res[i], b.find_right(rights[i]));
+  }
+}
+
+TEST(bimap, from_sorted) {
+  std::vector<std::pair<int, int>> data;
+  for (int i = 0; i < 1000; i++) {
+    data.push_back({i, (i * 7919) % 1000});
+  }
+  auto b = bimap<int, int>::from_sorted(data.begin(), data.end());
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_LE(tree_height(b.begin_left(), b.end_left()), 10);
+  EXPECT_LE(tree_height(b.begin_right(), b.end_right()), 10);
+  for (auto const& p : data) {
+    EXPECT_EQ(b.at_left(p.first), p.second);
+    EXPECT_EQ(b.at_right(p.second), p.first);
+  }
+
+  b.insert(1000, 1000);
+  b.erase_left(500);
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(b.at_right(1000), 1000);
+  EXPECT_EQ(b.find_left(500), b.end_left());
+}
+
+TEST(bimap, range_constructor_duplicates) {
+  std::vector<std::pair<int, int>> data = {
+      {5, 1}, {3, 2}, {5, 3}, {1, 2}, {4, 4}, {2, 4}};
+  bimap<int, int> b(data.begin(), data.end());
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.at_left(5), 1);
+  EXPECT_EQ(b.at_left(3), 2);
+  EXPECT_EQ(b.at_left(4), 4);
+  EXPECT_EQ(b.find_left(1), b.end_left());
+  EXPECT_EQ(b.find_left(2), b.end_left());
+
+  // Пара {1, 1} занимает right, освобожденный отброшенной {5, 3}, но не
+  // оставленной {5, 1}.
+  std::vector<std::pair<int, int>> chain = {{5, 1}, {5, 3}, {1, 1}};
+  bimap<int, int> c(chain.begin(), chain.end());
+  EXPECT_EQ(c.size(), 1);
+  EXPECT_EQ(c.at_left(5), 1);
+
+  std::mt19937 e(7);
+  for (int round = 0; round < 50; round++) {
+    std::vector<std::pair<int, int>> pairs;
+    for (int i = 0; i < 200; i++)
+      pairs.push_back({int(e() % 50), int(e() % 50)});
+    bimap<int, int> bulk(pairs.begin(), pairs.end()), seq;
+    for (auto const& p : pairs)
+      seq.insert(p.first, p.second);
+    EXPECT_EQ(bulk, seq);
+  }
+}
+
+TEST(bimap, copy_without_comparisons) {
+  size_t calls = 0;
+  bimap<int, int, counting_compare, counting_compare> b(
+      (counting_compare(&calls)), counting_compare(&calls));
+  for (int i = 0; i < 10000; i++) {
+    b.insert(i, -i);
+  }
+  calls = 0;
+  auto c = b;
+  EXPECT_EQ(calls, 0);
+  EXPECT_LE(tree_height(c.begin_left(), c.end_left()), 14);
+  EXPECT_LE(tree_height(c.begin_right(), c.end_right()), 14);
+  auto lit = b.begin_left();
+  auto cit = c.begin_left();
+  for (; lit != b.end_left(); lit++, cit++) {
+    EXPECT_EQ(*lit, *cit);
+    EXPECT_EQ(*lit.flip(), *cit.flip());
+  }
+  EXPECT_EQ(cit, c.end_left());
+}
+
+TEST(bimap, clear) {
+  size_t calls = 0;
+  bimap<int, int, counting_compare, counting_compare> b(
+      (counting_compare(&calls)), counting_compare(&calls));
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, 1000 - i);
+  }
+  calls = 0;
+  b.clear();
+  EXPECT_EQ(calls, 0);
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  EXPECT_EQ(b.begin_right(), b.end_right());
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+
+  b.insert(1, 2);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.at_left(1), 2);
+}
+
+TEST(bimap, clear_frees_nodes) {
+  using alloc_t = counting_allocator<std::pair<std::string, int>>;
+  allocation_stats stats;
+  bimap<std::string, int, std::less<std::string>, std::less<int>,
+        intrusive::avl_balance, alloc_t>
+      b(std::less<std::string>{}, std::less<int>{}, alloc_t(&stats));
+  for (int i = 0; i < 1000; i++) {
+    b.insert(std::to_string(i) + std::string(32, 'x'), i);
+  }
+  b.clear();
+  EXPECT_EQ(stats.allocations, 1000);
+  EXPECT_EQ(stats.deallocations, 1000);
+
+  using pool_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                           intrusive::avl_balance, pool_allocator<int>>;
+  pool_bimap p;
+  for (int i = 0; i < 1000; i++) {
+    p.insert(i, -i);
+  }
+  p.clear();
+  EXPECT_TRUE(p.empty());
+  p.insert(3, 4);
+  EXPECT_EQ(p.at_right(4), 3);
+}
+
+template <typename Balance>
+void check_order_statistic() {
+  using os_bimap =
+      bimap<int, int, std::less<int>, std::greater<int>, Balance,
+            std::allocator<std::pair<int, int>>, intrusive::order_statistic>;
+  os_bimap b;
+  std::map<int, int> left_view, right_view;
+  std::mt19937 e(2023);
+  for (int i = 0; i < 20000; i++) {
+    int l = e() % 2000, r = e() % 2000;
+    if (e() % 3 == 0) {
+      auto it = b.find_left(l);
+      if (it != b.end_left()) {
+        right_view.erase(-*it.flip());
+        left_view.erase(l);
+        b.erase_left(it);
+      }
+    } else if (b.insert(l, r) != b.end_left()) {
+      left_view.insert({l, r});
+      right_view.insert({-r, l});
+    }
+    if (i % 500 == 0) {
+      size_t k = 0;
+      for (auto& p : left_view) {
+        EXPECT_EQ(b.rank_left(p.first), k);
+        EXPECT_EQ(*b.nth_left(k), p.first);
+        k++;
+      }
+      k = 0;
+      for (auto& p : right_view) {
+        EXPECT_EQ(b.rank_right(-p.first), k);
+        EXPECT_EQ(*b.nth_right(k), -p.first);
+        k++;
+      }
+      EXPECT_EQ(b.nth_left(b.size()), b.end_left());
+      int a = e() % 2000, c = e() % 2000;
+      EXPECT_EQ(b.count_range_left(a, c),
+                a < c ? std::distance(left_view.lower_bound(a),
+                                      left_view.lower_bound(c))
+                      : 0);
+      EXPECT_EQ(b.distance(b.begin_right(), b.end_right()), b.size());
+      EXPECT_EQ(b.distance(b.end_left(), b.begin_left()),
+                -static_cast<ptrdiff_t>(b.size()));
+    }
+  }
+
+  auto c = b;
+  for (size_t k = 0; k < c.size(); k++) {
+    EXPECT_EQ(c.rank_left(*c.nth_left(k)), k);
+    EXPECT_EQ(c.rank_right(*c.nth_right(k)), k);
+  }
+}
+
+TEST(bimap, order_statistic_avl) {
+  check_order_statistic<intrusive::avl_balance>();
+}
+
+TEST(bimap, order_statistic_rb) {
+  check_order_statistic<intrusive::rb_balance>();
+}
+
+TEST(bimap, transparent_lookup) {
+  bimap<std::string, std::string, std::less<>, std::less<>> b;
+  b.insert("alpha", "one");
+  b.insert("beta", "two");
+  b.insert("gamma", "three");
+
+  std::string_view beta = "beta", two = "two";
+  EXPECT_EQ(*b.find_left(beta), "beta");
+  EXPECT_EQ(*b.find_right(two).flip(), "beta");
+  EXPECT_EQ(b.find_left(std::string_view("delta")), b.end_left());
+  EXPECT_EQ(b.at_left(beta), "two");
+  EXPECT_EQ(b.at_right(std::string_view("three")), "gamma");
+  EXPECT_THROW(b.at_left(std::string_view("zeta")), std::out_of_range);
+
+  EXPECT_EQ(*b.lower_bound_left(std::string_view("b")), "beta");
+  EXPECT_EQ(*b.upper_bound_left(beta), "gamma");
+  EXPECT_EQ(*b.lower_bound_right(std::string_view("p")), "three");
+  EXPECT_EQ(b.upper_bound_right(std::string_view("two")), b.end_right());
+
+  EXPECT_TRUE(b.erase_left(beta));
+  EXPECT_FALSE(b.erase_left(beta));
+  EXPECT_TRUE(b.erase_right(std::string_view("one")));
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.erase_left(b.begin_left()), b.end_left());
+  EXPECT_TRUE(b.empty());
+
+  // Прозрачный поиск доступен только по ключам, сравнимым с ключом стороны.
+  using map_t = decltype(b);
+  static_assert(details::transparent_key<char const*, std::string,
+                                         std::less<>>);
+  static_assert(!details::transparent_key<int, std::string, std::less<>>);
+  auto finds = []<typename K>(K const& key) {
+    return requires(map_t& m) { m.find_left(key); };
+  };
+  static_assert(!finds(42));
+  static_assert(!finds(1.5));
+  static_assert(finds(std::string_view("a")));
+}
+
+TEST(bimap, lookup_without_copies) {
+  bimap<copy_counting, copy_counting> b;
+  for (int i = 0; i < 100; i += 2) {
+    b.insert(copy_counting(i), copy_counting(-i));
+  }
+  copy_counting key(10), missing(11), right_key(-10);
+  copy_counting::copies = 0;
+
+  EXPECT_NE(b.find_left(key), b.end_left());
+  EXPECT_NE(b.find_right(right_key), b.end_right());
+  EXPECT_EQ(b.at_left(key).a, -10);
+  EXPECT_EQ(b.at_right(right_key).a, 10);
+  EXPECT_EQ(b.lower_bound_left(missing)->a, 12);
+  EXPECT_EQ(b.upper_bound_left(key)->a, 12);
+  EXPECT_EQ(b.lower_bound_right(right_key)->a, -10);
+  EXPECT_EQ(b.upper_bound_right(right_key)->a, -8);
+  EXPECT_EQ(b.insert(key, missing), b.end_left());
+  EXPECT_TRUE(b.erase_left(key));
+  EXPECT_FALSE(b.erase_right(right_key));
+  EXPECT_EQ(copy_counting::copies, 0);
+}
+
+TEST(bimap, emplace_pair) {
+  bimap<emplace_counting, emplace_counting, std::less<>, std::less<>> b;
+  emplace_counting::constructions = emplace_counting::moves = 0;
+
+  auto it = b.emplace_pair(std::piecewise_construct,
+                           std::forward_as_tuple(1, 2),
+                           std::forward_as_tuple(10, 20));
+  EXPECT_EQ(it->a, 3);
+  EXPECT_EQ(it.flip()->a, 30);
+  EXPECT_EQ(emplace_counting::constructions, 2);
+  EXPECT_EQ(emplace_counting::moves, 0);
+
+  it = b.emplace_pair(std::piecewise_construct, std::forward_as_tuple(3, 0),
+                      std::forward_as_tuple(5, 5));
+  EXPECT_EQ(it, b.end_left());
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(emplace_counting::moves, 0);
+}
+
+TEST(bimap, try_emplace) {
+  bimap<emplace_counting, emplace_counting, std::less<>, std::less<>> b;
+  emplace_counting::constructions = emplace_counting::moves = 0;
+
+  auto it = b.try_emplace(3, 30, std::piecewise_construct,
+                          std::forward_as_tuple(1, 2),
+                          std::forward_as_tuple(10, 20));
+  EXPECT_EQ(it->a, 3);
+  EXPECT_EQ(b.at_right(30).a, 3);
+  EXPECT_EQ(emplace_counting::constructions, 2);
+
+  it = b.try_emplace(3, 7, std::piecewise_construct,
+                     std::forward_as_tuple(3, 0), std::forward_as_tuple(3, 4));
+  EXPECT_EQ(it, b.end_left());
+  it = b.try_emplace(4, 30, std::piecewise_construct,
+                     std::forward_as_tuple(4, 0), std::forward_as_tuple(30, 0));
+  EXPECT_EQ(it, b.end_left());
+  EXPECT_EQ(emplace_counting::constructions, 2);
+  EXPECT_EQ(emplace_counting::moves, 0);
+
+  bimap<int, std::string> s;
+  s.try_emplace(1, std::string("aaa"), std::piecewise_construct,
+                std::forward_as_tuple(1), std::forward_as_tuple(3, 'a'));
+  EXPECT_EQ(s.at_left(1), "aaa");
+}
+
+TEST(bimap, custom_allocator) {
+  using alloc_t = counting_allocator<std::pair<int, int>>;
+  allocation_stats stats;
+  {
+    bimap<int, int, std::less<int>, std::less<int>, intrusive::avl_balance,
+          alloc_t>
+        b(std::less<int>{}, std::less<int>{}, alloc_t(&stats));
+    EXPECT_EQ(stats.allocations, 0);
+    for (int i = 0; i < 100; i++) {
+      b.insert(i, 100 - i);
+    }
+    b.insert(5, 1000);
+    EXPECT_EQ(stats.allocations, 100);
+    b.erase_left(5);
+    EXPECT_EQ(stats.deallocations, 1);
+
+    auto c = b;
+    EXPECT_EQ(c.get_allocator(), b.get_allocator());
+    EXPECT_EQ(stats.allocations, 199);
+  }
+  EXPECT_EQ(stats.allocations, stats.deallocations);
+}
+
+TEST(bimap, assign_with_unequal_allocators) {
+  using alloc_t = counting_allocator<std::pair<int, std::string>>;
+  using map_t = bimap<int, std::string, std::less<int>, std::less<>,
+                      intrusive::avl_balance, alloc_t>;
+  allocation_stats first, second;
+  {
+    map_t a(std::less<int>{}, std::less<>{}, alloc_t(&first));
+    map_t b(std::less<int>{}, std::less<>{}, alloc_t(&second));
+    for (int i = 0; i < 50; i++) {
+      a.insert(i, std::string(20, char('a' + i % 26)) + std::to_string(i));
+      b.insert(-i, std::to_string(i));
+    }
+    map_t expected = a;
+
+    // Аллокатор не переходит: узлы b берутся из second, а узлы a
+    // освобождаются через first.
+    b = std::move(a);
+    EXPECT_TRUE(a.empty());
+    EXPECT_EQ(b, expected);
+    EXPECT_EQ(b.get_allocator(), alloc_t(&second));
+    EXPECT_EQ(first.allocations - first.deallocations, 50);
+    EXPECT_EQ(second.allocations - second.deallocations, 50);
+
+    a.insert(1, "x");
+    b = a;
+    EXPECT_EQ(b.size(), 1);
+    EXPECT_EQ(b.get_allocator(), alloc_t(&second));
+    EXPECT_EQ(second.allocations - second.deallocations, 1);
+  }
+  EXPECT_EQ(first.allocations, first.deallocations);
+  EXPECT_EQ(second.allocations, second.deallocations);
+}
+
+TEST(bimap, extract_insert_node) {
+  using alloc_t = counting_allocator<std::pair<int, int>>;
+  using map_t = bimap<int, int, std::less<int>, std::less<int>,
+                      intrusive::avl_balance, alloc_t>;
+  allocation_stats stats;
+  {
+    map_t active(std::less<int>{}, std::less<int>{}, alloc_t(&stats));
+    map_t expired(std::less<int>{}, std::less<int>{}, alloc_t(&stats));
+    for (int i = 0; i < 10; i++)
+      active.insert(i, 100 + i);
+    EXPECT_EQ(stats.allocations, 10);
+
+    auto nh = active.extract_left(3);
+    EXPECT_FALSE(nh.empty());
+    EXPECT_EQ(nh.left(), 3);
+    EXPECT_EQ(nh.right(), 103);
+    EXPECT_EQ(active.size(), 9);
+    EXPECT_EQ(active.find_right(103), active.end_right());
+    auto res = expired.insert(std::move(nh));
+    EXPECT_TRUE(res.inserted);
+    EXPECT_TRUE(res.node.empty());
+    EXPECT_TRUE(nh.empty());
+    EXPECT_EQ(*res.position, 3);
+    EXPECT_EQ(expired.at_right(103), 3);
+
+    expired.insert(active.extract_right(active.find_right(105)));
+    expired.insert(active.extract_left(active.find_left(0)));
+    EXPECT_TRUE(active.extract_left(42).empty());
+    EXPECT_TRUE(active.extract_right(3).empty());
+    EXPECT_EQ(active.size(), 7);
+    EXPECT_EQ(expired.size(), 3);
+
+    // Ключи можно поменять, пока пара вне bimap.
+    nh = expired.extract_left(expired.begin_left());
+    nh.left() = 5;
+    auto conflict = expired.insert(std::move(nh));
+    EXPECT_FALSE(conflict.inserted);
+    EXPECT_TRUE(nh.empty());
+    EXPECT_EQ(conflict.node.left(), 5);
+    EXPECT_EQ(*conflict.position, 5);
+    nh = active.extract_left(1);
+    nh.right() = 103;
+    conflict = expired.insert(std::move(nh));
+    EXPECT_FALSE(conflict.inserted);
+    EXPECT_EQ(*conflict.position, 3);
+
+    // Первый непустой handle освободил узел при присваивании conflict.
+    EXPECT_EQ(stats.allocations, 10);
+    EXPECT_EQ(stats.deallocations, 1);
+    conflict = {};
+    EXPECT_EQ(stats.deallocations, 2);
+  }
+  EXPECT_EQ(stats.allocations, stats.deallocations);
+}
+
+TEST(bimap, extract_without_copies) {
+  bimap<copy_counting, copy_counting> a, b;
+  for (int i = 0; i < 100; i++)
+    a.insert(copy_counting(i), copy_counting(-i));
+  copy_counting::copies = 0;
+  for (int i = 0; i < 100; i += 2)
+    b.insert(a.extract_left(copy_counting(i)));
+  b.merge(a);
+  EXPECT_EQ(copy_counting::copies, 0);
+  EXPECT_TRUE(a.empty());
+  EXPECT_EQ(b.size(), 100);
+}
+
+TEST(bimap, merge) {
+  using alloc_t = counting_allocator<std::pair<int, int>>;
+  using map_t = bimap<int, int, std::less<int>, std::less<int>,
+                      intrusive::avl_balance, alloc_t>;
+  allocation_stats stats;
+  {
+    map_t a(std::less<int>{}, std::less<int>{}, alloc_t(&stats));
+    map_t b(std::less<int>{}, std::less<int>{}, alloc_t(&stats));
+    for (int i = 0; i < 100; i++) {
+      a.insert(2 * i, 2 * i);
+      b.insert(2 * i + 1, 2 * i + 1);
+    }
+    b.insert(1000, 0); // right 0 уже есть в a
+    b.insert(0, 1001); // left 0 уже есть в a
+    size_t allocations = stats.allocations;
+
+    a.merge(b);
+    EXPECT_EQ(stats.allocations, allocations);
+    EXPECT_EQ(a.size(), 200);
+    EXPECT_EQ(b.size(), 2);
+    EXPECT_EQ(b.at_left(1000), 0);
+    EXPECT_EQ(b.at_left(0), 1001);
+    int expected = 0;
+    for (auto it = a.begin_left(); it != a.end_left(); ++it, ++expected) {
+      EXPECT_EQ(*it, expected);
+      EXPECT_EQ(*it.flip(), expected);
+    }
+    EXPECT_LE(tree_height(a.begin_left(), a.end_left()),
+              2 * std::log2(a.size() + 2));
+    a.merge(a);
+    EXPECT_EQ(a.size(), 200);
+  }
+  EXPECT_EQ(stats.allocations, stats.deallocations);
+}
+
+TEST(bimap, replace_keys) {
+  allocation_stats stats;
+  using alloc_t = counting_allocator<std::pair<int, int>>;
+  bimap<int, int, std::less<int>, std::less<int>, intrusive::avl_balance,
+        alloc_t, intrusive::order_statistic>
+      b({}, {}, alloc_t(&stats));
+  for (int i = 0; i < 100; i++)
+    b.insert(i, 10 * i);
+  size_t allocations = stats.allocations;
+
+  auto it = b.find_left(5);
+  auto rit = it.flip();
+  EXPECT_TRUE(b.replace_right(it, 55));
+  EXPECT_EQ(*rit, 55);
+  EXPECT_EQ(rit.flip(), it);
+  EXPECT_TRUE(b.replace_right(it, 1005));
+  EXPECT_EQ(b.back_right(), 1005);
+  EXPECT_EQ(rit, std::prev(b.end_right()));
+  EXPECT_EQ(b.nth_right(99), rit);
+  EXPECT_TRUE(b.replace_right(it, -1));
+  EXPECT_EQ(b.begin_right(), rit);
+  EXPECT_EQ(b.count_range_right(0, 1000), 99);
+
+  // Занятый ключ: ничего не меняется. Свой ключ -- не конфликт.
+  EXPECT_FALSE(b.replace_right(it, 70));
+  EXPECT_EQ(b.at_right(-1), 5);
+  EXPECT_EQ(b.at_right(70), 7);
+  EXPECT_TRUE(b.replace_right(it, -1));
+  EXPECT_EQ(*it.flip(), -1);
+
+  EXPECT_TRUE(b.replace_left(b.find_right(70), 1000));
+  EXPECT_EQ(b.at_right(70), 1000);
+  EXPECT_EQ(b.back_left(), 1000);
+  EXPECT_EQ(b.find_left(7), b.end_left());
+  EXPECT_FALSE(b.replace_left(b.find_right(70), 0));
+  EXPECT_EQ(stats.allocations, allocations);
+  EXPECT_EQ(b.size(), 100);
+
+  bimap<int, int> one;
+  one.insert(1, 2);
+  EXPECT_TRUE(one.replace_right(one.begin_left(), 3));
+  EXPECT_TRUE(one.replace_left(one.begin_right(), 4));
+  EXPECT_EQ(one.at_left(4), 3);
+}
+
+TEST(bimap, replace_hashed) {
+  using hashed_string = intrusive::hashed<std::hash<std::string>>;
+  bimap<int, std::string, std::less<int>, hashed_string> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i, std::to_string(i));
+  auto it = b.find_left(42);
+  EXPECT_TRUE(b.replace_right(it, "forty-two"));
+  EXPECT_EQ(b.at_right("forty-two"), 42);
+  EXPECT_EQ(b.find_right("42"), b.end_right());
+  EXPECT_FALSE(b.replace_right(it, "7"));
+  EXPECT_EQ(*it.flip(), "forty-two");
+  EXPECT_TRUE(b.replace_left(b.find_right("7"), 1000));
+  EXPECT_EQ(b.at_left(1000), "7");
+  EXPECT_EQ(std::distance(b.begin_right(), b.end_right()), 100);
+}
+
+TEST(bimap, insert_or_assign) {
+  allocation_stats stats;
+  using alloc_t = counting_allocator<std::pair<int, int>>;
+  bimap<int, int, std::less<int>, std::less<int>, intrusive::avl_balance,
+        alloc_t>
+      b({}, {}, alloc_t(&stats));
+  for (int i = 0; i < 10; i++)
+    b.insert(i, 10 * i);
+
+  // Ни ключа, ни значения: новая пара.
+  auto [it, inserted] = b.insert_or_assign_left(100, 1000);
+  EXPECT_TRUE(inserted);
+  EXPECT_EQ(*it, 100);
+  EXPECT_EQ(*it.flip(), 1000);
+  EXPECT_EQ(b.size(), 11);
+  size_t allocations = stats.allocations;
+
+  // Пара уже есть.
+  std::tie(it, inserted) = b.insert_or_assign_left(3, 30);
+  EXPECT_FALSE(inserted);
+  EXPECT_EQ(it, b.find_left(3));
+
+  // Есть только ключ: прежнее значение 30 вытесняется, узел тот же.
+  auto old = b.find_left(3);
+  std::tie(it, inserted) = b.insert_or_assign_left(3, 35);
+  EXPECT_FALSE(inserted);
+  EXPECT_EQ(it, old);
+  EXPECT_EQ(b.at_right(35), 3);
+  EXPECT_EQ(b.find_right(30), b.end_right());
+
+  // Есть только значение: пара (4, 40) становится (-1, 40).
+  old = b.find_left(4);
+  std::tie(it, inserted) = b.insert_or_assign_left(-1, 40);
+  EXPECT_TRUE(inserted);
+  EXPECT_EQ(it, old);
+  EXPECT_EQ(it, b.begin_left());
+  EXPECT_EQ(b.at_right(40), -1);
+  EXPECT_EQ(b.find_left(4), b.end_left());
+  EXPECT_EQ(b.size(), 11);
+  EXPECT_EQ(stats.allocations, allocations);
+
+  // Есть и ключ, и значение в разных парах: пара значения удаляется.
+  old = b.find_left(5);
+  std::tie(it, inserted) = b.insert_or_assign_left(5, 60);
+  EXPECT_FALSE(inserted);
+  EXPECT_EQ(it, old);
+  EXPECT_EQ(b.at_left(5), 60);
+  EXPECT_EQ(b.find_left(6), b.end_left());
+  EXPECT_EQ(b.find_right(50), b.end_right());
+  EXPECT_EQ(b.size(), 10);
+  EXPECT_EQ(stats.deallocations, 1);
+
+  auto [rit, r_inserted] = b.insert_or_assign_right(60, 7);
+  EXPECT_FALSE(r_inserted);
+  EXPECT_EQ(*rit.flip(), 7);
+  EXPECT_EQ(b.find_left(5), b.end_left());
+  EXPECT_EQ(b.at_left(7), 60);
+  EXPECT_EQ(b.size(), 9);
+  std::tie(rit, r_inserted) = b.insert_or_assign_right(2000, 8);
+  EXPECT_TRUE(r_inserted);
+  EXPECT_EQ(b.at_right(2000), 8);
+  EXPECT_EQ(b.find_right(80), b.end_right());
+  EXPECT_EQ(b.size(), 9);
+  EXPECT_EQ(stats.allocations, allocations);
+}
+
+TEST(bimap, insert_or_assign_hashed) {
+  using hashed_string = intrusive::hashed<std::hash<std::string>>;
+  bimap<int, std::string, std::less<int>, hashed_string> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i, std::to_string(i));
+  EXPECT_FALSE(b.insert_or_assign_left(42, "x").second);
+  EXPECT_EQ(b.at_right("x"), 42);
+  EXPECT_EQ(b.find_right("42"), b.end_right());
+  EXPECT_FALSE(b.insert_or_assign_left(42, "7").second);
+  EXPECT_EQ(b.find_left(7), b.end_left());
+  EXPECT_EQ(b.find_right("x"), b.end_right());
+  EXPECT_FALSE(b.insert_or_assign_right("8", 1000).second);
+  EXPECT_EQ(b.at_left(1000), "8");
+  EXPECT_TRUE(b.insert_or_assign_right("y", 2000).second);
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(std::distance(b.begin_right(), b.end_right()), 100);
+}
+
+TEST(bimap, node_layout) {
+  using tree_t = intrusive::intrusive_tree<intrusive::node<>, std::less<>>;
+  for (auto layout : {intrusive::node_layout::preorder,
+                      intrusive::node_layout::van_emde_boas}) {
+    for (size_t n = 0; n < 300; n++) {
+      std::vector<size_t> order;
+      tree_t::for_each_built(n, layout, [&](size_t i) { order.push_back(i); });
+      ASSERT_EQ(order.size(), n);
+      if (n > 0) {
+        EXPECT_EQ(order[0], n / 2);
+      }
+      std::sort(order.begin(), order.end());
+      for (size_t i = 0; i < n; i++)
+        ASSERT_EQ(order[i], i);
+    }
+  }
+  // Дерево из 15 узлов: корень 7, под ним 3 и 11, затем по три узла
+  // каждого нижнего поддерева.
+  std::vector<size_t> veb;
+  tree_t::for_each_built(15, intrusive::node_layout::van_emde_boas,
+                         [&](size_t i) { veb.push_back(i); });
+  EXPECT_EQ(veb, (std::vector<size_t>{7, 3, 11, 1, 0, 2, 5, 4, 6, 9, 8, 10,
+                                      13, 12, 14}));
+}
+
+TEST(bimap, compact) {
+  allocation_stats stats;
+  using alloc_t = counting_allocator<std::pair<int, int>>;
+  bimap<int, int, std::less<int>, std::less<int>, intrusive::rb_balance,
+        alloc_t, intrusive::order_statistic>
+      b({}, {}, alloc_t(&stats));
+  b.compact_left();
+  EXPECT_EQ(stats.allocations, 0);
+
+  std::mt19937 e(1);
+  for (int i = 0; i < 3000; i++) {
+    b.insert(e() % 1000, e() % 1000);
+    b.erase_left(e() % 1000);
+  }
+  std::vector<std::pair<int, int>> pairs;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it)
+    pairs.emplace_back(*it, *it.flip());
+  size_t n = b.size(), allocations = stats.allocations;
+  ASSERT_GT(n, 100);
+
+  auto check = [&] {
+    EXPECT_EQ(b.size(), n);
+    EXPECT_EQ(stats.allocations - stats.deallocations, n);
+    ASSERT_TRUE(std::equal(b.begin_left(), b.end_left(), pairs.begin(),
+                           pairs.end(), [&](int l, auto const& p) {
+                             return l == p.first && b.at_left(l) == p.second;
+                           }));
+    EXPECT_TRUE(std::is_sorted(b.begin_right(), b.end_right()));
+    EXPECT_EQ(std::distance(b.begin_right(), b.end_right()), n);
+    size_t height = std::bit_width(n);
+    EXPECT_EQ(tree_height(b.begin_left(), b.end_left()), height);
+    EXPECT_EQ(tree_height(b.begin_right(), b.end_right()), height);
+    EXPECT_EQ(*b.nth_left(n / 2), pairs[n / 2].first);
+  };
+  b.compact_left();
+  EXPECT_EQ(stats.allocations, allocations + n);
+  check();
+  b.compact_right(intrusive::node_layout::preorder);
+  check();
+
+  // После перестройки деревья по-прежнему балансируются.
+  for (int i = 0; i < 1000; i++) {
+    b.insert(1000 + i, 1000 + i);
+    b.erase_left(1000 + i / 2);
+  }
+  EXPECT_LE(tree_height(b.begin_left(), b.end_left()),
+            2 * std::log2(b.size() + 2));
+}
+
+TEST(bimap, compact_hashed) {
+  using hashed_string = intrusive::hashed<std::hash<std::string>>;
+  bimap<int, std::string, std::less<int>, hashed_string> b;
+  for (int i = 0; i < 1000; i++)
+    b.insert(i, std::to_string(i));
+  for (int i = 0; i < 1000; i += 3)
+    b.erase_left(i);
+  b.compact_left(intrusive::node_layout::preorder);
+  EXPECT_EQ(b.size(), 666);
+  for (int i = 0; i < 1000; i++) {
+    if (i % 3 == 0) {
+      EXPECT_EQ(b.find_right(std::to_string(i)), b.end_right());
+    } else {
+      EXPECT_EQ(b.at_right(std::to_string(i)), i);
+      EXPECT_EQ(b.at_left(i), std::to_string(i));
+    }
+  }
+  EXPECT_EQ(std::distance(b.begin_right(), b.end_right()), 666);
+  b.insert(5000, "5000");
+  EXPECT_EQ(b.at_right("5000"), 5000);
+}
+
+template <typename Balance, typename Augment = intrusive::no_augment,
+          typename Allocator = std::allocator<std::pair<int, int>>>
+void check_split_join(int n, int watermark) {
+  using map_t =
+      bimap<int, int, std::less<int>, std::less<int>, Balance, Allocator,
+            Augment>;
+  map_t b;
+  for (int i = 0; i < n; i++)
+    b.insert(i, (i * 7919) % n);
+  map_t original = b;
+
+  map_t low = b.split_left(watermark);
+  int k = std::clamp(watermark, 0, n);
+  EXPECT_EQ(low.size(), k);
+  EXPECT_EQ(b.size(), n - k);
+  if (k > 0) {
+    EXPECT_EQ(low.front_left(), 0);
+    EXPECT_EQ(low.back_left(), k - 1);
+  }
+  if (k < n) {
+    EXPECT_EQ(b.front_left(), k);
+  }
+  for (int i = 0; i < n; i++) {
+    map_t const& side = i < watermark ? low : b;
+    map_t const& other = i < watermark ? b : low;
+    EXPECT_EQ(side.at_left(i), (i * 7919) % n);
+    EXPECT_EQ(side.at_right((i * 7919) % n), i);
+    EXPECT_EQ(other.find_left(i), other.end_left());
+    EXPECT_EQ(other.find_right((i * 7919) % n), other.end_right());
+  }
+  double bound = 2 * std::log2(n + 2);
+  EXPECT_LE(tree_height(b.begin_right(), b.end_right()), bound);
+  EXPECT_LE(tree_height(low.begin_right(), low.end_right()), bound);
+  EXPECT_EQ(std::distance(low.begin_right(), low.end_right()), k);
+  EXPECT_EQ(std::distance(b.begin_right(), b.end_right()), n - k);
+  if constexpr (Augment::counted) {
+    if (k < n) {
+      EXPECT_EQ(b.rank_left(k), 0);
+    }
+    EXPECT_EQ(low.rank_left(k), k);
+  }
+
+  b.join(std::move(low));
+  EXPECT_TRUE(low.empty());
+  EXPECT_EQ(b, original);
+  EXPECT_LE(tree_height(b.begin_left(), b.end_left()), bound);
+  EXPECT_LE(tree_height(b.begin_right(), b.end_right()), bound);
+}
+
+TEST(bimap, split_join) {
+  for (int watermark : {-1, 0, 1, 3, 500, 997, 999, 1000, 2000}) {
+    check_split_join<intrusive::avl_balance>(1000, watermark);
+    check_split_join<intrusive::rb_balance>(1000, watermark);
+    check_split_join<intrusive::avl_balance, intrusive::order_statistic>(
+        1000, watermark);
+    // Узлы low выделены пулом b и должны освобождаться им же.
+    check_split_join<intrusive::avl_balance, intrusive::no_augment,
+                     pool_allocator<int>>(1000, watermark);
+  }
+}
+
+TEST(bimap, join_conflicts) {
+  bimap<int, int> a, b;
+  for (int i = 0; i < 100; i++) {
+    a.insert(i, i);
+    b.insert(100 + i, 50 + 2 * i);
+  }
+  // Повторы right из b: 50, 52, ..., 98.
+  bimap<int, int> small;
+  small.insert(-1, 5);
+  small.insert(-2, 1000);
+  a.join(std::move(small));
+  EXPECT_EQ(a.size(), 101);
+  EXPECT_EQ(a.at_right(1000), -2);
+  EXPECT_EQ(a.at_right(5), 5);
+
+  a.join(std::move(b));
+  EXPECT_EQ(a.size(), 176);
+  EXPECT_EQ(a.at_right(52), 52);
+  EXPECT_EQ(a.at_right(100), 125);
+  EXPECT_EQ(a.find_left(101), a.end_left());
+  int prev = -3;
+  for (auto it = a.begin_left(); it != a.end_left(); ++it) {
+    EXPECT_LT(prev, *it);
+    prev = *it;
+  }
+}
+
+TEST(bimap, split_hashed_right) {
+  bimap<int, int, std::less<int>, intrusive::hashed<std::hash<int>>> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i, -i);
+  auto low = b.split_left(60);
+  EXPECT_EQ(low.size(), 60);
+  EXPECT_EQ(b.size(), 40);
+  EXPECT_EQ(low.at_right(-59), 59);
+  EXPECT_EQ(b.find_right(-59), b.end_right());
+  EXPECT_EQ(b.at_right(-60), 60);
+  auto high = b.split_left(99);
+  EXPECT_EQ(high.size(), 39);
+  EXPECT_EQ(b.size(), 1);
+  high.join(std::move(b));
+  high.join(std::move(low));
+  EXPECT_EQ(high.size(), 100);
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(high.at_right(-i), i);
+}
+
+template <typename CompareRight = std::less<int>>
+using stats_bimap =
+    bimap<int, int, std::less<int>, CompareRight, intrusive::avl_balance,
+          std::allocator<std::pair<int, int>>, intrusive::no_augment,
+          intrusive::counting_stats>;
+
+template <typename B>
+concept has_stats = requires(B const& b) { b.stats(); };
+
+TEST(bimap, stats_disabled_by_default) {
+  using plain = bimap<int, int>;
+  static_assert(!has_stats<plain>);
+  static_assert(has_stats<stats_bimap<>>);
+  static_assert(sizeof(plain::left_iterator) == sizeof(void*));
+  static_assert(sizeof(stats_bimap<>::left_iterator) == 2 * sizeof(void*));
+}
+
+TEST(bimap, stats_counters) {
+  constexpr int n = 1000;
+  stats_bimap<> b;
+  for (int i = 0; i < n; i++)
+    b.insert(i * 7 % n, i);
+  auto s = b.stats();
+  EXPECT_EQ(s.allocations, n);
+  EXPECT_EQ(s.deallocations, 0);
+  EXPECT_EQ(s.insert_comparisons.total(), n);
+  EXPECT_EQ(s.find_comparisons.total(), 0);
+  EXPECT_EQ(s.descent_length.total(), 2 * n);
+  EXPECT_GE(s.relinks, 2 * n);
+  EXPECT_GT(s.comparisons, 0);
+
+  b.reset_stats();
+  EXPECT_EQ(b.at_left(500), 500 * 143 % n);
+  s = b.stats();
+  EXPECT_EQ(s.find_comparisons.total(), 1);
+  EXPECT_EQ(s.descent_length.total(), 1);
+  // Спуск по AVL-дереву из 1000 узлов короче 15 уровней, на уровне -- не
+  // больше двух сравнений.
+  EXPECT_GT(s.comparisons, 0);
+  EXPECT_LE(s.comparisons, 30);
+  EXPECT_EQ(s.find_comparisons.counts[std::bit_width(s.comparisons)], 1);
+
+  b.reset_stats();
+  std::size_t count = 0;
+  for (auto it = b.begin_right(); it != b.end_right(); ++it)
+    count++;
+  EXPECT_EQ(count, n);
+  // Полный обход проходит каждое ребро дважды.
+  s = b.stats();
+  EXPECT_GE(s.iterator_steps, n);
+  EXPECT_LE(s.iterator_steps, 2 * n + 1);
+  EXPECT_EQ(s.comparisons, 0);
+
+  b.reset_stats();
+  auto it = b.find_left(3);
+  ++it.flip();
+  EXPECT_GT(b.stats().iterator_steps, 0);
+
+  b.reset_stats();
+  EXPECT_TRUE(b.erase_left(3));
+  EXPECT_FALSE(b.erase_right(-1));
+  s = b.stats();
+  EXPECT_EQ(s.erase_comparisons.total(), 2);
+  EXPECT_EQ(s.find_comparisons.total(), 0);
+  EXPECT_EQ(s.deallocations, 1);
+  EXPECT_GE(s.relinks, 2);
+
+  b.clear();
+  EXPECT_EQ(b.stats().deallocations, n);
+}
+
+TEST(bimap, at_or_default_single_probe) {
+  constexpr int n = 1000;
+  stats_bimap<> b;
+  for (int i = 0; i < n; i++)
+    b.insert(i, i + 1);
+  b.insert(-1, 0);
+
+  // Ключ есть: один спуск по левому дереву.
+  b.reset_stats();
+  EXPECT_EQ(b.at_left_or_default(500), 501);
+  EXPECT_EQ(b.stats().descent_length.total(), 1);
+
+  // Ключа нет, значение по умолчанию занято парой (-1, 0): по одному
+  // спуску на дерево, узел пары переиспользуется.
+  b.reset_stats();
+  EXPECT_EQ(b.at_left_or_default(2000), 0);
+  auto s = b.stats();
+  EXPECT_EQ(s.descent_length.total(), 2);
+  EXPECT_LE(s.comparisons, 2 * 30);
+  EXPECT_EQ(s.allocations, 0);
+  EXPECT_EQ(s.deallocations, 0);
+  EXPECT_EQ(b.at_right(0), 2000);
+  EXPECT_EQ(b.size(), n + 1);
+
+  b.reset_stats();
+  EXPECT_EQ(b.at_right_or_default(5000), 0);
+  s = b.stats();
+  EXPECT_EQ(s.descent_length.total(), 2);
+  EXPECT_EQ(s.allocations, 0);
+  EXPECT_EQ(b.at_left(0), 5000);
+  EXPECT_EQ(b.find_right(1), b.end_right());
+}
+
+TEST(bimap, stats_follow_pairs) {
+  stats_bimap<> a, b;
+  a.insert(1, 2);
+  b.insert(3, 4);
+  b.insert(5, 6);
+  a.swap(b);
+  EXPECT_EQ(a.stats().allocations, 2);
+  EXPECT_EQ(b.stats().allocations, 1);
+  a.insert(7, 8);
+  EXPECT_EQ(a.stats().allocations, 3);
+  EXPECT_EQ(b.stats().allocations, 1);
+
+  stats_bimap<> c(a);
+  EXPECT_EQ(c.stats().allocations, 3);
+  EXPECT_EQ(c.stats().insert_comparisons.total(), 0);
+
+  // Итераторы переживают перемещение и пишут в статистику нового
+  // владельца.
+  std::optional<stats_bimap<>> source(std::move(c));
+  auto it = source->begin_left();
+  stats_bimap<> moved(std::move(*source));
+  source.reset();
+  moved.reset_stats();
+  ++it;
+  EXPECT_EQ(*it, 5);
+  EXPECT_GT(moved.stats().iterator_steps, 0);
+  EXPECT_TRUE(c.empty());
+  c.insert(1, 1);
+  EXPECT_EQ(c.stats().allocations, 1);
+}
+
+TEST(bimap, stats_hashed) {
+  stats_bimap<intrusive::hashed<std::hash<int>>> b;
+  for (int i = 0; i < 100; i++)
+    b.insert(i, i);
+  b.reset_stats();
+  EXPECT_EQ(b.at_right(42), 42);
+  auto s = b.stats();
+  EXPECT_EQ(s.find_comparisons.total(), 1);
+  EXPECT_EQ(s.descent_length.total(), 1);
+  EXPECT_GE(s.comparisons, 1);
+
+  b.reset_stats();
+  for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+  }
+  EXPECT_EQ(b.stats().iterator_steps, 100);
+}
+
+TEST(bimap, pool_allocator) {
+  using pool_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                           intrusive::avl_balance, pool_allocator<int>>;
+  pool_bimap b;
+  std::map<int, int> left_view;
+  std::mt19937 e(42);
+  for (int i = 0; i < 20000; i++) {
+    int l = e() % 1000, r = e() % 1000;
+    if (e() % 3 == 0) {
+      b.erase_left(l);
+      left_view.erase(l);
+    } else if (b.insert(l, r) != b.end_left()) {
+      left_view.insert({l, r});
+    }
+  }
+  EXPECT_EQ(b.size(), left_view.size());
+  pool_bimap c = b;
+  EXPECT_EQ(b, c);
+  pool_bimap d = std::move(c);
+  EXPECT_TRUE(c.empty());
+  EXPECT_EQ(d.end_left().flip(), d.end_right());
+  EXPECT_EQ(b, d);
+  c = d;
+  c.swap(b);
+  EXPECT_EQ(b, d);
+  auto lit = b.begin_left();
+  for (auto& p : left_view) {
+    EXPECT_EQ(*lit, p.first);
+    EXPECT_EQ(*lit.flip(), p.second);
+    lit++;
+  }
+
+  // Ребинд делит пулы: аллокаторы bimap и node handle равны аллокатору,
+  // которым выделены узлы.
+  pool_allocator<long> rebound(b.get_allocator());
+  EXPECT_EQ(rebound, b.get_allocator());
+  EXPECT_EQ(pool_allocator<int>(rebound), b.get_allocator());
+  long* x = rebound.allocate(1);
+  rebound.deallocate(x, 1);
+  auto nh = b.extract_left(b.begin_left());
+  EXPECT_EQ(nh.get_allocator(), b.get_allocator());
+  EXPECT_TRUE(b.insert(std::move(nh)).inserted);
+}
+
+TEST(bimap, pool_allocator_shared) {
+  using pool_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                           intrusive::avl_balance, pool_allocator<int>>;
+  pool_allocator<int> a;
+  pool_bimap b1(std::less<int>(), std::less<int>(), a);
+  pool_bimap b2(std::less<int>(), std::less<int>(), a);
+  for (int i = 0; i < 100; i++) {
+    b1.insert(i, i);
+    b2.insert(i + 100, i + 100);
+  }
+  // Равенство копий не меняется после первой аллокации.
+  EXPECT_EQ(b1.get_allocator(), a);
+  EXPECT_EQ(b1.get_allocator(), b2.get_allocator());
+
+  EXPECT_TRUE(b2.insert(b1.extract_left(1)).inserted);
+  EXPECT_EQ(b2.at_left(1), 1);
+  EXPECT_EQ(b1.size(), 99);
+
+  pool_bimap b3(std::less<int>(), std::less<int>(), a);
+  for (int i = 200; i < 250; i++)
+    b3.insert(i, i);
+  b2.merge(b3);
+  EXPECT_TRUE(b3.empty());
+  EXPECT_EQ(b2.size(), 151);
+
+  pool_bimap low = b2.split_left(150);
+  EXPECT_EQ(low.get_allocator(), a);
+  EXPECT_TRUE(low.erase_left(1));
+  b1.join(std::move(low));
+  b1.join(std::move(b2));
+  EXPECT_EQ(b1.size(), 249);
+  EXPECT_EQ(b1.find_left(1), b1.end_left());
+  EXPECT_EQ(b1.at_left(249), 249);
+  EXPECT_EQ(b1.at_right(120), 120);
+}
+
+TEST(bimap, compact_allocator) {
+  using compact_bimap =
+      bimap<uint32_t, uint32_t, std::less<uint32_t>, std::less<uint32_t>,
+            intrusive::avl_balance, compact_allocator<uint32_t>>;
+  EXPECT_EQ(sizeof(details::node_t<uint32_t, uint32_t, intrusive::no_augment,
+                                   intrusive::compact_links>),
+            32);
+  compact_bimap b;
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+  std::map<uint32_t, uint32_t> left_view;
+  std::mt19937 e(42);
+  for (int i = 0; i < 20000; i++) {
+    uint32_t l = e() % 1000, r = e() % 1000;
+    if (e() % 3 == 0) {
+      b.erase_left(l);
+      left_view.erase(l);
+    } else if (b.insert(l, r) != b.end_left()) {
+      left_view.insert({l, r});
+    }
+  }
+  EXPECT_EQ(b.size(), left_view.size());
+  compact_bimap c = b;
+  EXPECT_EQ(b, c);
+  compact_bimap d = std::move(c);
+  EXPECT_TRUE(c.empty());
+  EXPECT_EQ(d.end_left().flip(), d.end_right());
+  EXPECT_EQ(d.end_right().flip(), d.end_left());
+  EXPECT_EQ(b, d);
+  c = d;
+  c.swap(b);
+  EXPECT_EQ(b, d);
+  auto lit = b.begin_left();
+  for (auto& p : left_view) {
+    EXPECT_EQ(*lit, p.first);
+    EXPECT_EQ(*lit.flip(), p.second);
+    lit++;
+  }
+  EXPECT_EQ(lit, b.end_left());
+  EXPECT_EQ(b.back_left(), left_view.rbegin()->first);
+  b.clear();
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  static_assert(!std::is_nothrow_move_constructible_v<compact_bimap>);
+  static_assert(std::is_nothrow_move_constructible_v<bimap<int, int>>);
+}
+
+TEST(bimap, compact_allocator_threads) {
+  using compact_bimap =
+      bimap<uint32_t, uint32_t, std::less<uint32_t>, std::less<uint32_t>,
+            intrusive::avl_balance, compact_allocator<uint32_t>>;
+  std::vector<compact_bimap> maps(4);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < maps.size(); t++) {
+    threads.emplace_back([&maps, t] {
+      for (uint32_t i = 0; i < 10000; i++)
+        maps[t].insert(i, i * 4 + t);
+    });
+  }
+  for (auto& th : threads)
+    th.join();
+  threads.clear();
+  // Узлы освобождает другой поток, а затем переиспользует третий.
+  threads.emplace_back([&maps] {
+    for (auto& m : maps)
+      m.erase_left(m.begin_left(), m.end_left());
+  });
+  threads.front().join();
+  threads.clear();
+  threads.emplace_back([&maps] {
+    for (uint32_t i = 0; i < 10000; i++)
+      maps[0].insert(i, i);
+  });
+  threads.front().join();
+  EXPECT_EQ(maps[0].size(), 10000);
+  EXPECT_EQ(maps[0].at_left(9999), 9999);
+  EXPECT_TRUE(maps[1].empty());
+}
+
+TEST(bimap, compact_allocator_after_thread_cache) {
+  using compact_bimap =
+      bimap<uint32_t, uint32_t, std::less<uint32_t>, std::less<uint32_t>,
+            intrusive::avl_balance, compact_allocator<uint32_t>>;
+  // Кэш арены создается позже late и разрушается раньше, так что узлы
+  // late освобождаются уже без кэша потока.
+  std::thread([] {
+    thread_local std::optional<compact_bimap> late;
+    late.emplace();
+    for (uint32_t i = 0; i < 1000; i++)
+      late->insert(i, i);
+  }).join();
+  compact_bimap b;
+  for (uint32_t i = 0; i < 1000; i++)
+    b.insert(i, 1000 - i);
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(b.at_left(10), 990);
+}
+
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename Balance, typename Allocator,
+          typename Augment>
+void check_frozen(bimap<Left, Right, CompareLeft, CompareRight, Balance,
+                        Allocator, Augment> const& b,
+                  std::vector<Left> const& left_queries,
+                  std::vector<Right> const& right_queries) {
+  frozen_bimap<Left, Right, CompareLeft, CompareRight> f(b);
+  ASSERT_EQ(f.size(), b.size());
+  EXPECT_EQ(f.empty(), b.empty());
+
+  auto fit = f.begin_left();
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++fit) {
+    ASSERT_NE(fit, f.end_left());
+    EXPECT_EQ(*fit, *it);
+    EXPECT_EQ(*fit.flip(), *it.flip());
+    EXPECT_EQ(fit.flip().flip(), fit);
+  }
+  EXPECT_EQ(fit, f.end_left());
+  auto frit = f.end_right();
+  for (auto it = b.end_right(); it != b.begin_right();) {
+    --it;
+    --frit;
+    EXPECT_EQ(*frit, *it);
+    EXPECT_EQ(*frit.flip(), *it.flip());
+  }
+  EXPECT_EQ(frit, f.begin_right());
+  EXPECT_EQ(f.end_left().flip(), f.end_right());
+
+  auto same = [](auto fit, auto fend, auto it, auto end) {
+    return (fit == fend) == (it == end) && (it == end || *fit == *it);
+  };
+  for (auto const& l : left_queries) {
+    EXPECT_TRUE(same(f.find_left(l), f.end_left(), b.find_left(l),
+                     b.end_left()));
+    EXPECT_TRUE(same(f.lower_bound_left(l), f.end_left(),
+                     b.lower_bound_left(l), b.end_left()));
+    EXPECT_TRUE(same(f.upper_bound_left(l), f.end_left(),
+                     b.upper_bound_left(l), b.end_left()));
+    if (b.find_left(l) != b.end_left())
+      EXPECT_EQ(f.at_left(l), b.at_left(l));
+    else
+      EXPECT_THROW(f.at_left(l), std::out_of_range);
+  }
+  for (auto const& r : right_queries) {
+    EXPECT_TRUE(same(f.find_right(r), f.end_right(), b.find_right(r),
+                     b.end_right()));
+    EXPECT_TRUE(same(f.lower_bound_right(r), f.end_right(),
+                     b.lower_bound_right(r), b.end_right()));
+    EXPECT_TRUE(same(f.upper_bound_right(r), f.end_right(),
+                     b.upper_bound_right(r), b.end_right()));
+    if (b.find_right(r) != b.end_right())
+      EXPECT_EQ(f.at_right(r), b.at_right(r));
+    else
+      EXPECT_THROW(f.at_right(r), std::out_of_range);
+  }
+}
+
+TEST(bimap, frozen) {
+  std::mt19937 e(2024);
+  std::vector<int> queries;
+  for (int i = -5; i < 2005; i++)
+    queries.push_back(i);
+  for (size_t n : {0, 1, 2, 3, 7, 8, 100, 1000}) {
+    bimap<int, int> b;
+    while (b.size() < n)
+      b.insert(e() % 2000, e() % 2000);
+    check_frozen(b, queries, queries);
+  }
+
+  bimap<int, std::string, std::greater<int>> strings;
+  std::vector<std::string> string_queries;
+  for (int i = 0; i < 500; i++) {
+    strings.insert(e() % 1000, std::to_string(e() % 1000));
+    string_queries.push_back(std::to_string(i));
+  }
+  check_frozen(strings, queries, string_queries);
+}
+
+TEST(bimap, frozen_stats) {
+  constexpr int n = 1000;
+  stats_bimap<> b;
+  for (int i = 0; i < n; i++)
+    b.insert(i, n - i);
+  frozen_bimap<int, int, std::less<int>, std::less<int>,
+               intrusive::counting_stats>
+      f(b);
+  auto s = f.stats();
+  EXPECT_EQ(s.comparisons, 0);
+
+  EXPECT_EQ(f.at_left(500), 500);
+  s = f.stats();
+  EXPECT_EQ(s.find_comparisons.total(), 1);
+  EXPECT_EQ(s.descent_length.total(), 1);
+  // Спуск по 1000 ключам -- 10 уровней и одна проверка равенства.
+  EXPECT_EQ(s.comparisons, 11);
+
+  f.reset_stats();
+  EXPECT_EQ(f.find_right(-1), f.end_right());
+  EXPECT_NE(f.lower_bound_left(10), f.end_left());
+  s = f.stats();
+  EXPECT_EQ(s.find_comparisons.total(), 1);
+  EXPECT_EQ(s.descent_length.total(), 2);
+}
+
+TEST(bimap, three_way_compare) {
+  constexpr int n = 1000;
+  size_t left_calls = 0, right_calls = 0;
+  bimap<int, int, counting_three_way, counting_compare> b{
+      counting_three_way(&left_calls), counting_compare(&right_calls)};
+  for (int i = 0; i < n; i++)
+    b.insert(i * 7 % n, i);
+  EXPECT_EQ(b.front_left(), n - 1);
+  EXPECT_EQ(b.back_left(), 0);
+  EXPECT_EQ(*b.lower_bound_left(500), 500);
+  EXPECT_EQ(*b.upper_bound_left(500), 499);
+  EXPECT_EQ(b.lower_bound_left(-1), b.end_left());
+
+  left_calls = right_calls = 0;
+  for (int i = 0; i < n; i++) {
+    size_t before = left_calls;
+    EXPECT_EQ(b.at_left(i * 7 % n), i);
+    // Один вызов на уровень AVL-дерева высоты не больше 14.
+    EXPECT_LE(left_calls - before, 14);
+    EXPECT_EQ(b.at_right(i), i * 7 % n);
+  }
+  EXPECT_LT(left_calls, right_calls);
+
+  auto copy = b;
+  left_calls = right_calls = 0;
+  EXPECT_TRUE(b == copy);
+  EXPECT_EQ(left_calls, n);
+  EXPECT_EQ(right_calls, 2 * n);
+
+  EXPECT_TRUE(b.erase_left(500));
+  EXPECT_FALSE(b.erase_left(500));
+  EXPECT_FALSE(b == copy);
+  EXPECT_NE(b.insert(500, 1000), b.end_left());
+  EXPECT_EQ(b.at_right(1000), 500);
+}
+
+TEST(bimap, compare_three_way_strings) {
+  using sv = std::string_view;
+  bimap<std::string, std::string, std::compare_three_way,
+        std::compare_three_way>
+      b;
+  std::vector<std::string> queries;
+  for (int i = 0; i < 300; i++) {
+    b.insert("left-" + std::to_string(i), "right-" + std::to_string(i * 3));
+    queries.push_back("left-" + std::to_string(i + 100));
+  }
+  EXPECT_EQ(b.at_left(sv("left-10")), "right-30");
+  EXPECT_EQ(b.at_right(sv("right-30")), "left-10");
+  EXPECT_EQ(b.find_left(sv("left-300")), b.end_left());
+  EXPECT_EQ(*b.lower_bound_left(sv("left-299~")), "left-3");
+  EXPECT_TRUE(b.erase_right(sv("right-3")));
+  EXPECT_EQ(b.find_left(sv("left-1")), b.end_left());
+  EXPECT_NE(b.insert("left-1", "x"), b.end_left());
+  EXPECT_EQ(b.insert("left-1000", "x"), b.end_left());
+  EXPECT_TRUE(std::is_sorted(b.begin_left(), b.end_left()));
+  EXPECT_TRUE(std::is_sorted(b.begin_right(), b.end_right()));
+  check_frozen(b, queries, queries);
+}
+
+TEST(bimap, hashed_side) {
+  using hashed_right = intrusive::hashed<std::hash<std::string>>;
+  bimap<int, std::string, std::less<int>, hashed_right> b;
+  for (int i = 0; i < 1000; i++)
+    EXPECT_NE(b.insert(i, std::to_string(i * 7)), b.end_left());
+  EXPECT_EQ(b.insert(1000, "7"), b.end_left());
+  EXPECT_EQ(b.insert(5, "unused"), b.end_left());
+  EXPECT_EQ(b.size(), 1000);
+
+  EXPECT_EQ(b.at_right("700"), 100);
+  EXPECT_EQ(b.at_left(100), "700");
+  EXPECT_THROW(b.at_right("1"), std::out_of_range);
+  EXPECT_EQ(b.find_right("1"), b.end_right());
+  EXPECT_EQ(b.end_right().flip(), b.end_left());
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+  EXPECT_EQ(*b.lower_bound_left(500), 500);
+
+  EXPECT_TRUE(b.erase_right("70"));
+  EXPECT_FALSE(b.erase_right("70"));
+  b.erase_left(20);
+  EXPECT_EQ(b.find_left(10), b.end_left());
+  EXPECT_EQ(b.find_right("140"), b.end_right());
+  EXPECT_EQ(b.size(), 998);
+
+  // Правая сторона обходится в порядке вставки, в обе стороны.
+  std::vector<std::string> forward(b.begin_right(), b.end_right());
+  EXPECT_EQ(forward.size(), 998);
+  EXPECT_EQ(forward.front(), "0");
+  EXPECT_EQ(forward.back(), "6993");
+  std::vector<std::string> backward;
+  for (auto it = b.end_right(); it != b.begin_right();)
+    backward.push_back(*--it);
+  std::reverse(backward.begin(), backward.end());
+  EXPECT_EQ(forward, backward);
+  for (auto it = b.begin_right(); it != b.end_right(); ++it)
+    EXPECT_EQ(*it.flip().flip(), *it);
+
+  std::vector<std::string> queries = {"0", "7", "70", "71", "6993"};
+  std::vector<decltype(b)::right_iterator> found(queries.size());
+  b.find_right_batch(queries, found);
+  for (size_t i = 0; i < queries.size(); i++)
+    EXPECT_EQ(found[i], b.find_right(queries[i]));
+
+  auto copy = b;
+  EXPECT_EQ(copy, b);
+  EXPECT_TRUE(copy.erase_right("0"));
+  EXPECT_NE(copy, b);
+  decltype(b) empty;
+  empty.swap(copy);
+  EXPECT_TRUE(copy.empty());
+  EXPECT_EQ(copy.begin_right(), copy.end_right());
+  EXPECT_EQ(empty.size(), 997);
+  EXPECT_EQ(empty.at_right("6993"), 999);
+  EXPECT_EQ(*--empty.end_right(), "6993");
+
+  b.clear();
+  EXPECT_TRUE(b.empty());
+  auto it = b.insert(1, "7");
+  EXPECT_EQ(it, b.begin_left());
+  EXPECT_EQ(b.at_right("7"), 1);
+}
+
+TEST(bimap, hashed_side_range_constructor) {
+  std::vector<std::pair<int, int>> data = {
+      {5, 1}, {3, 2}, {5, 3}, {1, 2}, {4, 4}, {2, 4}};
+  bimap<int, int, std::less<int>, intrusive::hashed<std::hash<int>>> b(
+      data.begin(), data.end());
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.at_left(5), 1);
+  EXPECT_EQ(b.at_left(3), 2);
+  EXPECT_EQ(b.at_left(4), 4);
+  EXPECT_EQ(b.find_left(1), b.end_left());
+  EXPECT_EQ(b.find_left(2), b.end_left());
+
+  std::vector<std::pair<int, int>> chain = {{5, 1}, {5, 3}, {1, 1}};
+  bimap<int, int, std::less<int>, intrusive::hashed<std::hash<int>>> c(
+      chain.begin(), chain.end());
+  EXPECT_EQ(c.size(), 1);
+  EXPECT_EQ(c.at_left(5), 1);
+
+  bimap<int, int, intrusive::hashed<std::hash<int>>> h(data.begin(),
+                                                       data.end());
+  EXPECT_EQ(h.size(), 3);
+  EXPECT_EQ(h.at_left(5), 1);
+  EXPECT_EQ(h.at_left(3), 2);
+  EXPECT_EQ(h.at_left(4), 4);
+}
+
+TEST(bimap, hashed_left_equality) {
+  using hashed_int = intrusive::hashed<std::hash<int>>;
+  bimap<int, int, hashed_int, hashed_int> a, b;
+  for (int i = 0; i < 100; i++) {
+    a.insert(i, -i);
+    b.insert(99 - i, i - 99);
+  }
+  EXPECT_EQ(a, b);
+  b.erase_left(50);
+  b.insert(50, 1000);
+  EXPECT_NE(a, b);
+}
+
 template <typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T>& lefts, std::vector<T>& rights, std::mt19937& e) {
@@ -391,6 +1949,10 @@ eliminate_same(std::vector<T>& lefts, std::vector<T>& rights, std::mt19937& e) {
 
 template struct bimap<int, non_default_constructible>;
 template struct bimap<non_default_constructible, int>;
+template struct bimap<int, int, std::less<int>,
+                      intrusive::hashed<std::hash<int>>>;
+template struct bimap<int, int, intrusive::hashed<std::hash<int>>,
+                      std::less<int>>;
 
 static constexpr uint32_t seed = 1488228;
 
@@ -464,10 +2026,39 @@ TEST(bimap_randomized, invariant_check) {
             << " erasures. " << skip << " skipped." << std::endl;
 }
 
-TEST(bimap_randomized, compare_to_two_maps) {
+template <typename Balance>
+void check_logarithmic_height(double factor) {
+  bimap<int, int, std::less<int>, std::less<int>, Balance> b;
+  size_t total = 1 << 16;
+  for (size_t i = 0; i < total; i++) {
+    b.insert(i, -static_cast<int>(i));
+  }
+  double bound = factor * std::log2(total + 2);
+  EXPECT_LE(tree_height(b.begin_left(), b.end_left()), bound);
+  EXPECT_LE(tree_height(b.begin_right(), b.end_right()), bound);
+
+  for (size_t i = 0; i < total; i += 2) {
+    b.erase_left(i);
+  }
+  EXPECT_EQ(b.size(), total / 2);
+  EXPECT_LE(tree_height(b.begin_left(), b.end_left()), bound);
+  EXPECT_LE(tree_height(b.begin_right(), b.end_right()), bound);
+}
+
+TEST(bimap, sorted_insert_height_avl) {
+  check_logarithmic_height<intrusive::avl_balance>(1.45);
+}
+
+TEST(bimap, sorted_insert_height_rb) {
+  check_logarithmic_height<intrusive::rb_balance>(2);
+}
+
+template <typename Balance,
+          typename Allocator = std::allocator<std::pair<int, int>>>
+void compare_to_two_maps() {
   std::cout << "Seed used for randomized cmp2map test is " << seed << std::endl;
 
-  bimap<int, int> b;
+  bimap<int, int, std::less<int>, std::less<int>, Balance, Allocator> b;
   std::map<int, int> left_view, right_view;
 
   std::mt19937 e(seed);
@@ -505,9 +2096,349 @@ TEST(bimap_randomized, compare_to_two_maps) {
         EXPECT_EQ(*lit, mlit->first);
         EXPECT_EQ(*lit.flip(), mlit->second);
       }
+      double bound = 2 * std::log2(b.size() + 2);
+      EXPECT_LE(tree_height(b.begin_left(), b.end_left()), bound);
+      EXPECT_LE(tree_height(b.begin_right(), b.end_right()), bound);
     }
   }
   std::cout << "Comparing to maps stat:" << std::endl;
   std::cout << "Performed " << ins << " insertions and " << total - ins - skip
             << " erasures. " << skip << " skipped." << std::endl;
 }
+
+TEST(bimap_randomized, compare_to_two_maps) {
+  compare_to_two_maps<intrusive::avl_balance>();
+}
+
+TEST(bimap_randomized, compare_to_two_maps_rb) {
+  compare_to_two_maps<intrusive::rb_balance>();
+}
+
+TEST(bimap_randomized, compare_to_two_maps_compact) {
+  compare_to_two_maps<intrusive::avl_balance, compact_allocator<int>>();
+}
+
+TEST(bimap_randomized, compare_to_two_maps_compact_rb) {
+  compare_to_two_maps<intrusive::rb_balance, compact_allocator<int>>();
+}
+
+// Случайные replace_left и replace_right со сверкой с двумя std::map и
+// проверкой высоты деревьев.
+template <typename Balance>
+void check_replace_randomized() {
+  bimap<int, int, std::less<int>, std::less<int>, Balance> b;
+  std::map<int, int> left_view, right_view;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 2000; i++) {
+    int l = e() % 4000, r = e() % 4000;
+    if (b.insert(l, r) != b.end_left()) {
+      left_view[l] = r;
+      right_view[r] = l;
+    }
+  }
+  for (int i = 0; i < 40000; i++) {
+    int key = e() % 4000;
+    if (e() % 2) {
+      auto it = b.lower_bound_left(e() % 4000);
+      if (it == b.end_left())
+        continue;
+      int old = *it.flip();
+      bool free = !right_view.count(key) || right_view[key] == *it;
+      ASSERT_EQ(b.replace_right(it, key), free);
+      if (free) {
+        right_view.erase(old);
+        right_view[key] = *it;
+        left_view[*it] = key;
+      }
+    } else {
+      auto it = b.lower_bound_right(e() % 4000);
+      if (it == b.end_right())
+        continue;
+      int old = *it.flip();
+      bool free = !left_view.count(key) || left_view[key] == *it;
+      ASSERT_EQ(b.replace_left(it, key), free);
+      if (free) {
+        left_view.erase(old);
+        left_view[key] = *it;
+        right_view[*it] = key;
+      }
+    }
+    if (i % 1000 == 0) {
+      ASSERT_TRUE(std::equal(b.begin_left(), b.end_left(), left_view.begin(),
+                             left_view.end(), [&](int l, auto const& p) {
+                               return l == p.first &&
+                                      b.at_left(l) == p.second;
+                             }));
+      ASSERT_TRUE(std::equal(b.begin_right(), b.end_right(),
+                             right_view.begin(), right_view.end(),
+                             [](int r, auto const& p) {
+                               return r == p.first;
+                             }));
+      double bound = 2 * std::log2(b.size() + 2);
+      EXPECT_LE(tree_height(b.begin_left(), b.end_left()), bound);
+      EXPECT_LE(tree_height(b.begin_right(), b.end_right()), bound);
+    }
+  }
+}
+
+TEST(bimap_randomized, replace_keys) {
+  check_replace_randomized<intrusive::avl_balance>();
+  check_replace_randomized<intrusive::rb_balance>();
+}
+
+template <typename Balance>
+void check_insert_or_assign_randomized() {
+  bimap<int, int, std::less<int>, std::less<int>, Balance> b;
+  std::map<int, int> left_view, right_view;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 40000; i++) {
+    int key = e() % 3000, value = e() % 3000;
+    bool by_left = e() % 2;
+    std::map<int, int>& own = by_left ? left_view : right_view;
+    std::map<int, int>& other = by_left ? right_view : left_view;
+    bool fresh = !own.count(key);
+    if (!fresh)
+      other.erase(own[key]);
+    if (other.count(value))
+      own.erase(other[value]);
+    own[key] = value;
+    other[value] = key;
+    if (by_left) {
+      auto [it, inserted] = b.insert_or_assign_left(key, value);
+      ASSERT_EQ(inserted, fresh);
+      ASSERT_EQ(*it, key);
+      ASSERT_EQ(*it.flip(), value);
+    } else {
+      auto [it, inserted] = b.insert_or_assign_right(key, value);
+      ASSERT_EQ(inserted, fresh);
+      ASSERT_EQ(*it, key);
+      ASSERT_EQ(*it.flip(), value);
+    }
+    ASSERT_EQ(b.size(), left_view.size());
+    if (i % 1000 == 0) {
+      ASSERT_TRUE(std::equal(b.begin_left(), b.end_left(), left_view.begin(),
+                             left_view.end(), [&](int l, auto const& p) {
+                               return l == p.first &&
+                                      b.at_left(l) == p.second;
+                             }));
+      ASSERT_TRUE(std::equal(b.begin_right(), b.end_right(),
+                             right_view.begin(), right_view.end(),
+                             [](int r, auto const& p) {
+                               return r == p.first;
+                             }));
+      double bound = 2 * std::log2(b.size() + 2);
+      EXPECT_LE(tree_height(b.begin_left(), b.end_left()), bound);
+      EXPECT_LE(tree_height(b.begin_right(), b.end_right()), bound);
+    }
+  }
+}
+
+TEST(bimap_randomized, insert_or_assign) {
+  check_insert_or_assign_randomized<intrusive::avl_balance>();
+  check_insert_or_assign_randomized<intrusive::rb_balance>();
+}
+
+TEST(bimap, concurrent_single_thread) {
+  concurrent_bimap<int, std::string> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(1, "one"));
+  EXPECT_TRUE(b.insert(2, "two"));
+  EXPECT_FALSE(b.insert(3, "one"));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.find_left(1), "one");
+  EXPECT_EQ(b.find_right("two"), 2);
+  EXPECT_EQ(b.find_left(3), std::nullopt);
+  EXPECT_TRUE(b.erase_right("one"));
+  EXPECT_FALSE(b.erase_left(1));
+  EXPECT_EQ(b.read([](auto const& m) { return *m.begin_left(); }), 2);
+  b.clear();
+  EXPECT_TRUE(b.empty());
+}
+
+// Писатель перестраивает деревья, читатели все время ищут ключи, которые
+// никогда не удаляются, и проверяют пары остальных.
+TEST(bimap_randomized, concurrent_readers) {
+  concurrent_bimap<int, int> b;
+  constexpr int stable = 100;
+  for (int i = 0; i < stable; i++)
+    b.insert(i, -i);
+
+  std::atomic<bool> done{false};
+  std::atomic<size_t> errors{0}, reads{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&, t] {
+      std::mt19937 e(seed + t);
+      // На одном ядре читатель может начать уже после писателя, поэтому
+      // хотя бы одно чтение делается всегда. Число чтений ограничено,
+      // чтобы писатель не ждал читателей бесконечно долго.
+      size_t local_reads = 0;
+      do {
+        int k = e() % 2000;
+        auto r = b.find_left(k);
+        if (k < stable ? r != -k : r && *r != -k)
+          errors++;
+        auto l = b.find_right(-k);
+        if (l && *l != k)
+          errors++;
+        reads++;
+        if (local_reads++ % 256 != 0)
+          continue;
+        bool consistent = b.read([](auto const& m) {
+          size_t n = 0;
+          for (auto it = m.begin_left(); it != m.end_left(); ++it, ++n)
+            if (*it.flip() != -*it)
+              return false;
+          return n == m.size();
+        });
+        if (!consistent)
+          errors++;
+      } while (!done.load() && local_reads < 20000);
+    });
+  }
+
+  std::mt19937 e(seed);
+  for (int i = 0; i < 1000; i++) {
+    int k = stable + e() % 1900;
+    if (e() % 2)
+      b.insert(k, -k);
+    else
+      b.erase_left(k);
+  }
+  done = true;
+  for (auto& r : readers)
+    r.join();
+  EXPECT_EQ(errors.load(), 0);
+  EXPECT_GT(reads.load(), 0);
+  for (int i = 0; i < stable; i++)
+    EXPECT_EQ(b.find_left(i), -i);
+}
+
+TEST(bimap, sharded) {
+  sharded_bimap<int, std::string> b(8);
+  EXPECT_EQ(b.shard_count(), 8);
+  for (int i = 0; i < 100; i++)
+    EXPECT_TRUE(b.insert(i, std::to_string(i)));
+  // Повторы ищутся во всех shard'ах, независимо от того, куда попал ключ.
+  for (int i = 0; i < 100; i++) {
+    EXPECT_FALSE(b.insert(i + 100, std::to_string(i)));
+    EXPECT_FALSE(b.insert(i, std::to_string(i + 100)));
+  }
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(b.find_left(42), "42");
+  EXPECT_EQ(b.find_right("42"), 42);
+  EXPECT_EQ(b.find_left(100), std::nullopt);
+
+  EXPECT_TRUE(b.erase_left(42));
+  EXPECT_FALSE(b.erase_left(42));
+  EXPECT_TRUE(b.erase_right("43"));
+  EXPECT_FALSE(b.erase_right("43"));
+  EXPECT_EQ(b.find_right("42"), std::nullopt);
+  EXPECT_EQ(b.find_left(43), std::nullopt);
+  EXPECT_TRUE(b.insert(43, "42"));
+  EXPECT_EQ(b.size(), 99);
+
+  std::vector<std::pair<int, std::string>> pairs;
+  b.for_each([&](int left, std::string const& right) {
+    pairs.push_back({left, right});
+  });
+  EXPECT_EQ(pairs.size(), 99);
+  for (auto const& [left, right] : pairs)
+    EXPECT_EQ(b.find_right(right), left);
+
+  using small_t = sharded_bimap<int, int>;
+  EXPECT_THROW(small_t(0), std::invalid_argument);
+}
+
+// Писатели конкурируют за одни и те же left и right; в конце обе стороны
+// должны описывать одно и то же множество пар.
+TEST(bimap_randomized, sharded_writers) {
+  sharded_bimap<int, int> b(16);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; t++) {
+    writers.emplace_back([&, t] {
+      std::mt19937 e(seed + t);
+      for (int i = 0; i < 20000; i++) {
+        int l = e() % 500, r = e() % 500;
+        switch (e() % 4) {
+        case 0:
+          b.erase_left(l);
+          break;
+        case 1:
+          b.erase_right(r);
+          break;
+        default:
+          b.insert(l, r);
+        }
+      }
+    });
+  }
+  for (auto& w : writers)
+    w.join();
+
+  std::map<int, int> pairs;
+  b.for_each([&](int left, int right) { pairs.insert({left, right}); });
+  EXPECT_EQ(pairs.size(), b.size());
+  std::map<int, int> rights;
+  for (auto [left, right] : pairs) {
+    EXPECT_EQ(b.find_right(right), left);
+    EXPECT_TRUE(rights.insert({right, left}).second);
+  }
+  for (int r = 0; r < 500; r++) {
+    auto left = b.find_right(r);
+    EXPECT_EQ(left.has_value(), rights.contains(r));
+  }
+}
+
+template <typename Allocator = std::allocator<std::pair<int, int>>>
+void compare_hashed_to_two_maps() {
+  bimap<int, int, std::less<int>, intrusive::hashed<std::hash<int>>,
+        intrusive::avl_balance, Allocator>
+      b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 60000; i++) {
+    unsigned int op = e() % 10;
+    // Небольшой диапазон, чтобы были повторы и промахи.
+    int l = e() % 20000, r = e() % 20000;
+    if (op > 3) {
+      bool inserted = b.insert(l, r) != b.end_left();
+      bool expected = !left_view.contains(l) && !right_view.contains(r);
+      EXPECT_EQ(inserted, expected);
+      if (expected) {
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else if (op > 1) {
+      auto it = right_view.find(r);
+      EXPECT_EQ(b.erase_right(r), it != right_view.end());
+      if (it != right_view.end()) {
+        left_view.erase(it->second);
+        right_view.erase(it);
+      }
+    } else {
+      auto it = b.find_right(r);
+      auto mit = right_view.find(r);
+      EXPECT_EQ(it == b.end_right(), mit == right_view.end());
+      if (mit != right_view.end()) {
+        EXPECT_EQ(*it.flip(), mit->second);
+      }
+    }
+    if (i % 1000 == 0) {
+      EXPECT_EQ(b.size(), right_view.size());
+      std::map<int, int> seen;
+      for (auto it = b.begin_right(); it != b.end_right(); ++it)
+        seen.insert({*it, *it.flip()});
+      EXPECT_EQ(seen, right_view);
+    }
+  }
+}
+
+TEST(bimap_randomized, compare_hashed_to_two_maps) {
+  compare_hashed_to_two_maps();
+}
+
+TEST(bimap_randomized, compare_hashed_to_two_maps_compact) {
+  compare_hashed_to_two_maps<compact_allocator<int>>();
+}